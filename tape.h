@@ -0,0 +1,627 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*****************************************************************/
+/****************************** TAPE *****************************/
+/*****************************************************************/
+/* A bidirectional tape of symbol IDs stored in fixed-size pages.
+
+    Cells are addressed by signed positions, so the head may move left of cell 0
+    and right without bound. Pages are allocated lazily on the first write of a
+    non-blank symbol; reading an untouched page returns a shared blank page, so a
+    head that wanders far over blank cells commits no memory. Pages are indexed
+    by a hash table, which keeps memory proportional to the written pages only,
+    and the last two pages looked up are cached so a head oscillating across a
+    page boundary does not hash on every step.
+
+    Engines keep a raw pointer to the current page and only call page_at() when
+    the head crosses a page boundary, and materialize() when writing a changed
+    symbol into the shared blank page.
+
+    With dirty tracking on, every page handed out for writing (by page_at() or
+    materialize()) is marked dirty until take_dirty() collects it. Marking happens on
+    the page lookup rather than on each write, so it stays off the per-step path: a
+    page is dirty if the head entered it, whether or not a cell changed. The lookup
+    cache is dropped by take_dirty() so the next entry into a page marks it again.
+*/
+struct TapeSegment {
+    long long start;        // position of cells[0]
+    const uint8_t *cells;
+    size_t size;
+};
+
+class Tape {
+
+    public:
+        static constexpr int PAGE_BITS = 12;
+        static constexpr long long PAGE_SIZE = 1LL << PAGE_BITS;
+
+        static long long page_start_of(long long pos) {
+            return pos & ~(PAGE_SIZE - 1);
+        }
+
+    private:
+        uint8_t blank;
+        std::vector<uint8_t> blank_page;
+        std::unordered_map<long long, uint8_t *> pages;      // page start -> page cells
+        std::vector<std::unique_ptr<uint8_t[]>> storage;     // owned pages, in use or free
+        std::vector<uint8_t *> free_pages;                   // pages released by reset()
+        long long lowest_page = LLONG_MAX;                   // start of the lowest allocated page
+        long long highest_page = LLONG_MIN;                  // start of the highest allocated page
+
+        bool tracking = false;
+        std::unordered_set<long long> dirty;                 // pages handed out since take_dirty()
+
+        long long cached_start[2] = {1, 1};                 // 1 is never a page start
+        uint8_t *cached_page[2] = {nullptr, nullptr};
+
+        void remember(long long page_start, uint8_t *page) {
+            this->cached_start[1] = this->cached_start[0];
+            this->cached_page[1] = this->cached_page[0];
+            this->cached_start[0] = page_start;
+            this->cached_page[0] = page;
+        }
+
+        void forget_cache() {
+            this->cached_start[0] = this->cached_start[1] = 1;
+        }
+
+    public:
+        explicit Tape(uint8_t blank = 0) : blank(blank), blank_page(PAGE_SIZE, blank) {}
+
+        Tape(const Tape &) = delete;
+        Tape &operator=(const Tape &) = delete;
+        Tape(Tape &&) = default;
+        Tape &operator=(Tape &&) = default;
+
+        uint8_t blank_symbol() const {
+            return this->blank;
+        }
+
+        // Clears the tape to all blanks, keeping allocated pages for reuse
+        void reset(uint8_t new_blank) {
+            for (auto &page : this->pages) {
+                this->free_pages.push_back(page.second);
+            }
+            this->pages.clear();
+            this->dirty.clear();
+            this->lowest_page = LLONG_MAX;
+            this->highest_page = LLONG_MIN;
+            forget_cache();
+            if (new_blank != this->blank) {
+                this->blank = new_blank;
+                std::fill(this->blank_page.begin(), this->blank_page.end(), new_blank);
+            }
+        }
+
+        void reset() {
+            reset(this->blank);
+        }
+
+        bool is_blank_page(const uint8_t *page) const {
+            return page == this->blank_page.data();
+        }
+
+        // Returns the cells of the page starting at page_start; untouched pages map to the shared blank page
+        uint8_t *page_at(long long page_start) {
+            if (page_start == this->cached_start[0]) {
+                return this->cached_page[0];
+            }
+            if (page_start == this->cached_start[1]) {
+                std::swap(this->cached_start[0], this->cached_start[1]);
+                std::swap(this->cached_page[0], this->cached_page[1]);
+                return this->cached_page[0];
+            }
+            auto it = this->pages.find(page_start);
+            uint8_t *page = (it == this->pages.end()) ? this->blank_page.data() : it->second;
+            if (this->tracking && it != this->pages.end()) {
+                this->dirty.insert(page_start);
+            }
+            remember(page_start, page);
+            return page;
+        }
+
+        const uint8_t *page_at(long long page_start) const {
+            auto it = this->pages.find(page_start);
+            return (it == this->pages.end()) ? this->blank_page.data() : it->second;
+        }
+
+        // Allocates a blank page at page_start (or returns the existing one) so it can be written
+        uint8_t *materialize(long long page_start) {
+            auto it = this->pages.find(page_start);
+            if (it != this->pages.end()) {
+                return it->second;
+            }
+            uint8_t *page;
+            if (!this->free_pages.empty()) {
+                page = this->free_pages.back();
+                this->free_pages.pop_back();
+            } else {
+                this->storage.emplace_back(new uint8_t[PAGE_SIZE]);
+                page = this->storage.back().get();
+            }
+            std::memset(page, this->blank, PAGE_SIZE);
+            this->pages.emplace(page_start, page);
+            if (this->tracking) {
+                this->dirty.insert(page_start);
+            }
+            this->lowest_page = std::min(this->lowest_page, page_start);
+            this->highest_page = std::max(this->highest_page, page_start);
+            forget_cache();
+            remember(page_start, page);
+            return page;
+        }
+
+        uint8_t get(long long pos) const {
+            return page_at(page_start_of(pos))[pos - page_start_of(pos)];
+        }
+
+        void set(long long pos, uint8_t symbol) {
+            long long start = page_start_of(pos);
+            uint8_t *page = page_at(start);
+            if (page[pos - start] == symbol) {
+                return;
+            }
+            if (is_blank_page(page)) {
+                page = materialize(start);
+            }
+            page[pos - start] = symbol;
+        }
+
+        // Start of the lowest / highest allocated page; every cell outside them is blank
+        long long lowest_page_start() const {
+            return this->lowest_page;
+        }
+
+        long long highest_page_start() const {
+            return this->highest_page;
+        }
+
+        size_t page_count() const {
+            return this->pages.size();
+        }
+
+        // Starts marking pages dirty; every allocated page starts out dirty
+        void track_dirty() {
+            this->tracking = true;
+            for (auto &page : this->pages) {
+                this->dirty.insert(page.first);
+            }
+            forget_cache();
+        }
+
+        // Returns the dirty pages in position order and marks every page clean
+        std::vector<long long> take_dirty() {
+            std::vector<long long> result(this->dirty.begin(), this->dirty.end());
+            std::sort(result.begin(), result.end());
+            this->dirty.clear();
+            forget_cache();
+            return result;
+        }
+
+        size_t memory_bytes() const {
+            return this->storage.size() * PAGE_SIZE + this->pages.size() * 2 * sizeof(void *);
+        }
+
+        // Returns the allocated pages in position order, without copying their cells
+        std::vector<TapeSegment> segments() const {
+            std::vector<TapeSegment> result;
+            result.reserve(this->pages.size());
+            for (auto &page : this->pages) {
+                result.push_back({page.first, page.second, size_t(PAGE_SIZE)});
+            }
+            std::sort(result.begin(), result.end(), [](const TapeSegment &a, const TapeSegment &b) {
+                return a.start < b.start;
+            });
+            return result;
+        }
+
+        // Returns [lowest, highest] positions holding a non-blank symbol, or an empty range (1, 0) for a blank tape
+        std::pair<long long, long long> nonblank_range() const {
+            long long lo = 1, hi = 0;
+            for (auto &page : this->pages) {
+                for (long long i = 0; i < PAGE_SIZE; i++) {
+                    if (page.second[i] != this->blank) {
+                        long long pos = page.first + i;
+                        if (lo > hi) {
+                            lo = hi = pos;
+                        } else {
+                            lo = std::min(lo, pos);
+                            hi = std::max(hi, pos);
+                        }
+                    }
+                }
+            }
+            return std::make_pair(lo, hi);
+        }
+};
+
+/*****************************************************************/
+/************************** PACKED TAPE **************************/
+/*****************************************************************/
+/* A bidirectional tape storing BITS (1, 2 or 4) bits per cell, for machines with at most 2^BITS symbols.
+
+    Pages cover the same PAGE_SIZE cells as Tape's pages but take PAGE_SIZE * BITS / 8
+    bytes, as 64-bit words of 64 / BITS cells each. Cell i of a word is held in bits
+    [i * BITS, (i + 1) * BITS), so a read or write is a shift and a mask. As in Tape,
+    untouched pages read as a shared blank page and are allocated on the first write.
+
+    find_other() finds the next cell, in one direction, holding a symbol other than x.
+    It XORs each word with x repeated across the word. A word made up only of x gives
+    zero; otherwise the lowest (or highest) set bit marks the first differing cell.
+    When x is the blank, unallocated pages are skipped whole, and so is everything
+    beyond the outermost allocated page.
+*/
+template <int BITS>
+class PackedTape {
+
+    public:
+        static constexpr int PAGE_BITS = Tape::PAGE_BITS;
+        static constexpr long long PAGE_SIZE = Tape::PAGE_SIZE;
+        static constexpr int CELLS_PER_WORD = 64 / BITS;
+        static constexpr size_t WORDS_PER_PAGE = PAGE_SIZE / CELLS_PER_WORD;
+        static constexpr uint64_t MASK = (1ULL << BITS) - 1;
+
+        static long long page_start_of(long long pos) {
+            return pos & ~(PAGE_SIZE - 1);
+        }
+
+        // The symbol repeated in every cell of a word
+        static uint64_t repeat(uint8_t symbol) {
+            return (~0ULL / MASK) * symbol;
+        }
+
+        // Offsets are in [0, PAGE_SIZE); unsigned, the division and remainder are a shift and a mask
+        static uint8_t cell(const uint64_t *page, size_t offset) {
+            return uint8_t((page[offset / CELLS_PER_WORD] >> ((offset % CELLS_PER_WORD) * BITS)) & MASK);
+        }
+
+        static void set_cell(uint64_t *page, size_t offset, uint8_t symbol) {
+            unsigned shift = (offset % CELLS_PER_WORD) * BITS;
+            uint64_t &word = page[offset / CELLS_PER_WORD];
+            word = (word & ~(MASK << shift)) | (uint64_t(symbol) << shift);
+        }
+
+    private:
+        uint8_t blank;
+        std::vector<uint64_t> blank_page;
+        std::unordered_map<long long, uint64_t *> pages;    // page start -> page words
+        std::vector<std::unique_ptr<uint64_t[]>> storage;   // owned pages, in use or free
+        std::vector<uint64_t *> free_pages;                 // pages released by reset()
+        long long lowest_page = LLONG_MAX;
+        long long highest_page = LLONG_MIN;
+        long long cached_start = 1;                         // 1 is never a page start
+        uint64_t *cached_page = nullptr;
+
+    public:
+        explicit PackedTape(uint8_t blank = 0) : blank(blank), blank_page(WORDS_PER_PAGE, repeat(blank)) {}
+
+        PackedTape(const PackedTape &) = delete;
+        PackedTape &operator=(const PackedTape &) = delete;
+        PackedTape(PackedTape &&) = default;
+        PackedTape &operator=(PackedTape &&) = default;
+
+        uint8_t blank_symbol() const {
+            return this->blank;
+        }
+
+        // Clears the tape to all blanks, keeping allocated pages for reuse
+        void reset(uint8_t new_blank) {
+            for (auto &page : this->pages) {
+                this->free_pages.push_back(page.second);
+            }
+            this->pages.clear();
+            this->lowest_page = LLONG_MAX;
+            this->highest_page = LLONG_MIN;
+            this->cached_start = 1;
+            if (new_blank != this->blank) {
+                this->blank = new_blank;
+                std::fill(this->blank_page.begin(), this->blank_page.end(), repeat(new_blank));
+            }
+        }
+
+        bool is_blank_page(const uint64_t *page) const {
+            return page == this->blank_page.data();
+        }
+
+        uint64_t *page_at(long long page_start) {
+            if (page_start == this->cached_start) {
+                return this->cached_page;
+            }
+            auto it = this->pages.find(page_start);
+            uint64_t *page = (it == this->pages.end()) ? this->blank_page.data() : it->second;
+            this->cached_start = page_start;
+            this->cached_page = page;
+            return page;
+        }
+
+        const uint64_t *page_at(long long page_start) const {
+            auto it = this->pages.find(page_start);
+            return (it == this->pages.end()) ? this->blank_page.data() : it->second;
+        }
+
+        uint64_t *materialize(long long page_start) {
+            auto it = this->pages.find(page_start);
+            if (it != this->pages.end()) {
+                return it->second;
+            }
+            uint64_t *page;
+            if (!this->free_pages.empty()) {
+                page = this->free_pages.back();
+                this->free_pages.pop_back();
+            } else {
+                this->storage.emplace_back(new uint64_t[WORDS_PER_PAGE]);
+                page = this->storage.back().get();
+            }
+            std::fill(page, page + WORDS_PER_PAGE, repeat(this->blank));
+            this->pages.emplace(page_start, page);
+            this->lowest_page = std::min(this->lowest_page, page_start);
+            this->highest_page = std::max(this->highest_page, page_start);
+            this->cached_start = page_start;
+            this->cached_page = page;
+            return page;
+        }
+
+        uint8_t get(long long pos) const {
+            return cell(page_at(page_start_of(pos)), pos - page_start_of(pos));
+        }
+
+        void set(long long pos, uint8_t symbol) {
+            long long start = page_start_of(pos);
+            uint64_t *page = page_at(start);
+            if (cell(page, pos - start) == symbol) {
+                return;
+            }
+            if (is_blank_page(page)) {
+                page = materialize(start);
+            }
+            set_cell(page, pos - start, symbol);
+        }
+
+        /* Returns the first position from pos on, stepping by direction (+1 or -1), whose cell is not symbol.
+
+            At most limit cells are examined: if the limit cells from pos all hold the
+            symbol, the result is pos + direction * limit.
+        */
+        long long find_other(long long pos, uint8_t symbol, int direction, long long limit) {
+            const long long end = pos + direction * limit;
+            const uint64_t pattern = repeat(symbol);
+            while (direction > 0 ? pos < end : pos > end) {
+                if (symbol == this->blank &&
+                    (this->pages.empty() || (direction > 0 ? pos >= this->highest_page + PAGE_SIZE : pos < this->lowest_page))) {
+                    return end;
+                }
+                long long start = page_start_of(pos);
+                const uint64_t *page = page_at(start);
+                if (is_blank_page(page)) {
+                    if (symbol != this->blank) {
+                        return pos;
+                    }
+                    pos = (direction > 0) ? start + PAGE_SIZE : start - 1;
+                    continue;
+                }
+                long long offset = pos - start;
+                long long w = offset / CELLS_PER_WORD;
+                int shift = (offset % CELLS_PER_WORD) * BITS;
+                if (direction > 0) {
+                    uint64_t diff = ((page[w] ^ pattern) >> shift) << shift;
+                    while (diff == 0 && ++w < (long long)WORDS_PER_PAGE) {
+                        diff = page[w] ^ pattern;
+                    }
+                    if (diff != 0) {
+                        long long found = start + w * CELLS_PER_WORD + __builtin_ctzll(diff) / BITS;
+                        return std::min(found, end);
+                    }
+                    pos = start + PAGE_SIZE;
+                } else {
+                    uint64_t keep = (shift + BITS == 64) ? ~0ULL : ((1ULL << (shift + BITS)) - 1);
+                    uint64_t diff = (page[w] ^ pattern) & keep;
+                    while (diff == 0 && --w >= 0) {
+                        diff = page[w] ^ pattern;
+                    }
+                    if (diff != 0) {
+                        long long found = start + w * CELLS_PER_WORD + (63 - __builtin_clzll(diff)) / BITS;
+                        return std::max(found, end);
+                    }
+                    pos = start - 1;
+                }
+            }
+            return end;
+        }
+
+        size_t page_count() const {
+            return this->pages.size();
+        }
+
+        size_t memory_bytes() const {
+            return this->storage.size() * WORDS_PER_PAGE * sizeof(uint64_t) + this->pages.size() * 2 * sizeof(void *);
+        }
+
+        // Returns [lowest, highest] positions holding a non-blank symbol, or an empty range (1, 0) for a blank tape
+        std::pair<long long, long long> nonblank_range() const {
+            long long lo = 1, hi = 0;
+            for (auto &page : this->pages) {
+                for (long long i = 0; i < PAGE_SIZE; i++) {
+                    if (cell(page.second, i) != this->blank) {
+                        long long pos = page.first + i;
+                        if (lo > hi) {
+                            lo = hi = pos;
+                        } else {
+                            lo = std::min(lo, pos);
+                            hi = std::max(hi, pos);
+                        }
+                    }
+                }
+            }
+            return std::make_pair(lo, hi);
+        }
+};
+
+/*****************************************************************/
+/*************************** COW TAPE ****************************/
+/*****************************************************************/
+/* A tape whose pages are shared copy-on-write between copies.
+
+    Used where configurations branch: copying a CowTape copies only its list of
+    page pointers, and a page is cloned the first time a copy writes to it while
+    another copy still holds it. Pages are small (256 cells) since every write to
+    a shared page clones the whole page.
+
+    The tape also keeps an order-independent hash of its non-blank cells, updated
+    on every write, so equal tapes hash equally however their pages were built.
+    Live pages are counted in an optional CowStats shared by all the copies.
+*/
+struct CowStats {
+    std::atomic<long long> live_pages{0};
+    std::atomic<long long> peak_pages{0};
+
+    void page_created() {
+        long long live = ++this->live_pages;
+        long long peak = this->peak_pages.load();
+        while (live > peak && !this->peak_pages.compare_exchange_weak(peak, live)) {
+        }
+    }
+
+    void page_destroyed() {
+        --this->live_pages;
+    }
+};
+
+class CowTape {
+
+    public:
+        static constexpr int PAGE_BITS = 8;
+        static constexpr long long PAGE_SIZE = 1LL << PAGE_BITS;
+
+    private:
+        struct Page {
+            uint8_t cells[PAGE_SIZE];
+            CowStats *stats;
+
+            explicit Page(CowStats *stats) : stats(stats) {
+                if (stats) {
+                    stats->page_created();
+                }
+            }
+
+            ~Page() {
+                if (this->stats) {
+                    this->stats->page_destroyed();
+                }
+            }
+        };
+
+        uint8_t blank;
+        CowStats *stats;
+        std::vector<std::pair<long long, std::shared_ptr<Page>>> pages;     // sorted by page start
+        uint64_t hash = 0;
+
+        static uint64_t cell_hash(long long pos, uint8_t symbol) {
+            uint64_t x = uint64_t(pos) * 0x9E3779B97F4A7C15ULL + symbol;
+            x ^= x >> 31;
+            x *= 0xBF58476D1CE4E5B9ULL;
+            x ^= x >> 29;
+            return x;
+        }
+
+        size_t find_page(long long page_start) const {
+            auto it = std::lower_bound(this->pages.begin(), this->pages.end(), page_start,
+                [](const std::pair<long long, std::shared_ptr<Page>> &page, long long start) {
+                    return page.first < start;
+                });
+            return size_t(it - this->pages.begin());
+        }
+
+    public:
+        explicit CowTape(uint8_t blank = 0, CowStats *stats = nullptr) : blank(blank), stats(stats) {}
+
+        uint8_t blank_symbol() const {
+            return this->blank;
+        }
+
+        uint8_t get(long long pos) const {
+            long long start = pos & ~(PAGE_SIZE - 1);
+            size_t i = find_page(start);
+            if (i == this->pages.size() || this->pages[i].first != start) {
+                return this->blank;
+            }
+            return this->pages[i].second->cells[pos - start];
+        }
+
+        void set(long long pos, uint8_t symbol) {
+            long long start = pos & ~(PAGE_SIZE - 1);
+            size_t i = find_page(start);
+            uint8_t old_symbol = this->blank;
+            if (i == this->pages.size() || this->pages[i].first != start) {
+                if (symbol == this->blank) {
+                    return;
+                }
+                std::shared_ptr<Page> page = std::make_shared<Page>(this->stats);
+                std::memset(page->cells, this->blank, PAGE_SIZE);
+                this->pages.insert(this->pages.begin() + i, std::make_pair(start, std::move(page)));
+            } else {
+                old_symbol = this->pages[i].second->cells[pos - start];
+                if (old_symbol == symbol) {
+                    return;
+                }
+                if (this->pages[i].second.use_count() > 1) {
+                    std::shared_ptr<Page> copy = std::make_shared<Page>(this->stats);
+                    std::memcpy(copy->cells, this->pages[i].second->cells, PAGE_SIZE);
+                    this->pages[i].second = std::move(copy);
+                }
+            }
+            this->pages[i].second->cells[pos - start] = symbol;
+            if (old_symbol != this->blank) {
+                this->hash -= cell_hash(pos, old_symbol);
+            }
+            if (symbol != this->blank) {
+                this->hash += cell_hash(pos, symbol);
+            }
+        }
+
+        uint64_t content_hash() const {
+            return this->hash;
+        }
+
+        // True if both tapes hold the same symbol in every cell; a missing page reads as blank
+        bool same_cells(const CowTape &other) const {
+            if (this->hash != other.hash || this->blank != other.blank) {
+                return false;
+            }
+            uint8_t blank_page[PAGE_SIZE];
+            std::memset(blank_page, this->blank, PAGE_SIZE);
+            auto cells_of = [&](const Page *page) {
+                return (page != nullptr) ? (const uint8_t *)page->cells : (const uint8_t *)blank_page;
+            };
+            size_t i = 0, j = 0;
+            while (i < this->pages.size() || j < other.pages.size()) {
+                long long a = (i < this->pages.size()) ? this->pages[i].first : LLONG_MAX;
+                long long b = (j < other.pages.size()) ? other.pages[j].first : LLONG_MAX;
+                const Page *page_a = (a <= b) ? this->pages[i].second.get() : nullptr;
+                const Page *page_b = (b <= a) ? other.pages[j].second.get() : nullptr;
+                if (page_a != page_b && std::memcmp(cells_of(page_a), cells_of(page_b), PAGE_SIZE) != 0) {
+                    return false;
+                }
+                i += (a <= b);
+                j += (b <= a);
+            }
+            return true;
+        }
+
+        size_t page_count() const {
+            return this->pages.size();
+        }
+};
+
+#endif
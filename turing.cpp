@@ -1,539 +1,7035 @@
-#include <iostream>
-#include <vector>
-#include <tuple>
-#include <string>
-#include <map>
-#include <set>
-#include <algorithm>
-
-using namespace std;
-
-
-/***************************************************************/
-/*********************** OUTPUT FORMATTING *********************/
-/***************************************************************/
-string bold(string str) {
-    return "\033[1m" + str + "\033[0m";
-}
-
-string underline(string str) {
-    return "\033[4m" + str + "\033[0m";
-}
-
-string red(string str) {
-    return "\033[31m" + str + "\033[0m";
-}
-
-string green(string str) {
-    return "\033[32m" + str + "\033[0m";
-}
-
-string cyan(string str) {
-    return "\033[36m" + str + "\033[0m";
-}
-
-/*****************************************************************/
-/************************ HELPER FUNCTIONS ***********************/
-/*****************************************************************/
-static inline void ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-        return !std::isspace(ch);
-    }));
-}
-
-static inline void rtrim(std::string &s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
-        return !std::isspace(ch);
-    }).base(), s.end());
-}
-
-static inline void trim(std::string &s) {
-    ltrim(s);
-    rtrim(s);
-}
-
-static inline std::string ltrim_copy(std::string s) {
-    ltrim(s);
-    return s;
-}
-
-static inline std::string rtrim_copy(std::string s) {
-    rtrim(s);
-    return s;
-}
-
-static inline std::string trim_copy(std::string s) {
-    trim(s);
-    return s;
-}
-
-/*****************************************************************/
-/************************ INPUT FUNCTIONS ************************/
-/*****************************************************************/
-int take_valid_int_input(string prompt, int min_val = 1, int max_val = INT_MAX) {
-    int num;
-    string input;
-    while(true) {
-        cout << prompt;
-        cin >> input;
-        if (input.size() == 0) {}
-        else if (input.find_first_not_of("0123456789") != string::npos) {}
-        else if ((num = stoi(input)) >= min_val && num <= max_val) {
-            return num;
-        }
-        cout << red("Error: Invalid input.") << endl;
-    }
-}
-
-char take_valid_char_input(string prompt) {
-    char c;
-    string input;
-    while(true) {
-        cout << prompt;
-        cin >> input;
-        if (input.size() == 1) {
-            return input[0];
-        }
-        cout << red("Error: Invalid input.") << endl;
-    }
-}
-
-string take_valid_string_input(string prompt) {
-    string input;
-    while(true) {
-        cout << prompt;
-        cin >> input;
-        if (input.size() > 0) {
-            return input;
-        }
-        cout << red("Error: Invalid input.") << endl;
-    }
-}
-
-/*****************************************************************/
-/************************ TURING MACHINE *************************/
-/*****************************************************************/
-class TuringMachine {
-
-    private:
-        /***************** Turing Machine specifications *****************/
-        set<string> states;
-        string initial_state;
-        set<char> input_symbols, tape_symbols;
-        map<tuple<string, char>, tuple<string, char, char>> transitions;
-        set<char> valid_actions = {'L', 'R', 'Y', 'N'};
-
-        /***************** Functions to check validity of TM specs input *****************/
-        bool check_valid_state(string state) {
-            bool is_valid_string = (state.size() > 0);
-            bool is_not_duplicate = (this->states.find(state) == this->states.end());
-            return is_valid_string && is_not_duplicate;
-        }
-
-        bool check_valid_symbol(char symbol, set<char> symbol_set) {
-            bool is_not_duplicate = (symbol_set.find(symbol) == symbol_set.end());
-            return is_not_duplicate;
-        }
-
-        bool check_valid_tape_symbol_set() {
-            for (char input_symbol : input_symbols) {
-                if (this->tape_symbols.find(input_symbol) == this->tape_symbols.end()) {
-                    return false;
-                }
-            }
-            return true;
-        }
-
-        bool check_valid_transition(string transition) {
-            string temp_trans = "" + transition;
-            
-            size_t comma1 = temp_trans.find(',');
-            size_t comma2 = temp_trans.find(',', comma1 + 1);
-            size_t openParen = temp_trans.find('(');
-            size_t closeParen = temp_trans.find(')');
-
-            if (comma1 == string::npos || comma2 == string::npos || openParen == string::npos || closeParen == string::npos) {
-                return false;
-            }
-
-            string state = trim_copy(temp_trans.substr(openParen + 1, comma1 - openParen - 1));
-            char write_symbol = trim_copy(temp_trans.substr(comma1 + 1, comma2 - comma1 - 1))[0];
-            char action = toupper(trim_copy(temp_trans.substr(comma2 + 1, closeParen - comma2 - 1))[0]);
-
-            bool is_valid_action = (this->valid_actions.find(action) != this->valid_actions.end());
-            bool is_valid_write_symbol = (this->tape_symbols.find(write_symbol) != this->tape_symbols.end());
-            bool is_valid_state = (this->states.find(state) != this->states.end());
-
-            return is_valid_action && is_valid_write_symbol && is_valid_state;
-        }
-
-        bool check_valid_tape(string tape) {
-            for (int i = 0; i < tape.size(); i++) {
-                if (this->tape_symbols.find(tape[i]) == this->tape_symbols.end()) {
-                    return false;
-                }
-            }
-            return true;
-        }
-
-    public:
-        /************************* Getters *************************/
-        set<string> get_states() {
-            return states;
-        }
-
-        string get_initial_state() {
-            return initial_state;
-        }
-
-        set<char> get_input_symbols() {
-            return input_symbols;
-        }
-
-        set<char> get_tape_symbols() {
-            return tape_symbols;
-        }
-
-        map<tuple<string, char>, tuple<string, char, char>> get_transitions() {
-            return transitions;
-        }
-
-        // This function takes Turing Machine specifications as input from the user
-        void get_TM_specs_from_user() {
-            // Read states
-            int n_states = take_valid_int_input(bold("Enter number of states: "));
-            for (int i = 0; i < n_states; i++) {
-                string prompt = "Enter state " + to_string(i + 1) + "/" + to_string(n_states) + ": ";
-                string state = take_valid_string_input(prompt);
-                if (check_valid_state(state)) {
-                    this->states.insert(state);
-                } else {
-                    cout << red("Error: Invalid state.") << endl;
-                    i--;
-                }
-            }
-            
-            // Read input symbols
-            cout << "==================================\n";
-            int n_ipsymbols = take_valid_int_input(bold("Enter number of input symbols: "));
-            for (int i = 0; i < n_ipsymbols; i++) {
-                char input_symbol = take_valid_char_input("Enter input symbol " + to_string(i + 1) + "/" + to_string(n_ipsymbols) + ": ");
-                if (check_valid_symbol(input_symbol, input_symbols)) {
-                    input_symbols.insert(input_symbol);
-                } else {
-                    cout << red("Error: Invalid input symbol.") << endl;
-                    i--;
-                }
-            }
-            
-            // Read tape symbols
-            cout << "==================================\n" << cyan("Note: Tape symbols must include input symbols.") << endl;
-            int n_tsymbols = take_valid_int_input(bold("Enter number of tape symbols: "), n_ipsymbols, INT_MAX);
-            while(true) {
-                for (int i = 0; i < n_tsymbols; i++) {
-                    char tape_symbol = take_valid_char_input("Enter tape symbol " + to_string(i + 1) + "/" + to_string(n_tsymbols) + ": ");
-                    if (check_valid_symbol(tape_symbol, this->tape_symbols)) {
-                        this->tape_symbols.insert(tape_symbol);
-                    } else {
-                        cout << red("Error: Invalid tape symbol.") << endl;
-                        i--;
-                    }
-                }
-                if (check_valid_tape_symbol_set())
-                    break;
-                cout << red("Error: Input symbols must be a subset of tape symbols.") << endl;
-                this->tape_symbols.clear();
-            }
-            
-            char left_mark;
-            while(true) {
-                left_mark = take_valid_char_input("Add transition for left mark \'<\'? (y/n): ");
-                if (left_mark == 'y') {
-                    this->tape_symbols.insert('<');
-                    n_tsymbols++;
-                    break;
-                } else if (left_mark == 'n') {
-                    break;
-                }
-                cout << red("Error: Invalid input.") << endl;
-            }
-
-            // Read initial state
-            cout << "==================================\n";
-            while(true) {
-                initial_state = take_valid_string_input(bold("Enter initial state: "));
-                if (this->states.find(initial_state) != this->states.end()) {
-                    break;
-                }
-                cout << red("Error: Unrecognized state.") << endl;
-            }
-            
-            
-            // Read transitions
-            cout << "==================================\n" << cyan("Note: Transitions must be in the format (state,tapeSymbol) -> (nextState,writeSymbol,move) without spaces") << endl;
-            int n_transitions = n_states * n_tsymbols;
-            vector<char> tape_symbols_vec(this->tape_symbols.begin(), this->tape_symbols.end());
-            cout << bold(underline("State transitions:")) << endl;
-            for (string state : this->states) {
-                for (int i = 0; i < n_tsymbols; i++) {
-                    char tape_symbol = tape_symbols_vec[i];
-                    string prompt = "(" + state + "," + tape_symbol + ") -> ";
-                    string transition = take_valid_string_input(prompt);
-                    if (check_valid_transition(transition)) {
-                        size_t comma1 = transition.find(',');
-                        size_t comma2 = transition.find(',', comma1 + 1);
-                        size_t openParen = transition.find('(');
-                        size_t closeParen = transition.find(')');
-
-                        string next_state = trim_copy(transition.substr(openParen + 1, comma1 - openParen - 1));
-                        char write_symbol = trim_copy(transition.substr(comma1 + 1, comma2 - comma1 - 1))[0];
-                        char action = toupper(trim_copy(transition.substr(comma2 + 1, closeParen - comma2 - 1))[0]);
-
-                        transitions[make_tuple(state, tape_symbol)] = make_tuple(next_state, write_symbol, action);
-                    } else {
-                        cout << red("Error: Invalid transition.") << endl;
-                        i--;
-                    }
-                }
-            }
-        }
-
-        // This function prints the Turing Machine specifications to the console
-        void print_TM_specs() {
-            cout << "==================================\n";
-            cout << bold(underline("Turing Machine specifications:")) << endl;
-            // cout << bold("M = (K, Σ, Γ, δ, S)") << endl;
-            // cout << bold("K = {");
-            cout << bold("States = {");
-            if (!this->states.empty()) {
-                auto it = this->states.begin();
-                cout << *it;
-                ++it;
-                for (; it != this->states.end(); ++it) {
-                    cout << ", " << *it;
-                }
-            }
-            cout << "}" << endl;
-
-            // cout << bold("Σ = {");
-            cout << bold("Input symbols = {");
-            if (!this->input_symbols.empty()) {
-                auto it = this->input_symbols.begin();
-                cout << *it;
-                ++it;
-                for (; it != this->input_symbols.end(); ++it) {
-                    cout << ", " << *it;
-                }
-            }
-            cout << "}" << endl;
-
-            // cout << bold("Γ = {");
-            cout << bold("Tape symbols = {");
-            if (!this->tape_symbols.empty()) {
-                auto it = this->tape_symbols.begin();
-                cout << *it;
-                ++it;
-                for (; it != this->tape_symbols.end(); ++it) {
-                    cout << ", " << *it;
-                }
-            }
-            cout << "}" << endl;
-
-            // cout << bold("S = ") << this->initial_state << endl;
-            cout << bold("Initial state = ") << this->initial_state << endl;
-
-            // cout << bold("δ = (") << endl;
-            cout << bold("Transitions = (") << endl;
-            for (auto transition : this->transitions) {
-                string state = get<0>(transition.first);
-                char tape_symbol = get<1>(transition.first);
-                string next_state = get<0>(transition.second);
-                char write_symbol = get<1>(transition.second);
-                char action = get<2>(transition.second);
-
-                cout << "(" << state << "," << tape_symbol << ") , (" << next_state << "," << write_symbol << "," << action << ")" << endl;
-            }
-            cout << ")" << endl << endl;
-        }
-
-        // This function takes input tape and head position from the user
-        pair<string, int> get_input_tape() {
-            cout << cyan("Note: Enter tape without spaces.") << endl;
-            string tape;
-            while (true) {
-                tape = take_valid_string_input(bold("Tape: ") + "<");
-                if (check_valid_tape(tape)) {
-                    break;
-                }
-                cout << red("Error: Invalid tape.") << endl;
-            }
-            tape = "<" + tape;
-
-            cout << cyan("Note: Left mark is at position 0. Your string probably starts at position 1") << endl;
-            int head_pos = take_valid_int_input(bold("Enter initial head position: "), 0);
-            if (head_pos >= tape.size()) {
-                tape += string(head_pos - tape.size() + 1, '#');
-            }
-            return make_pair(tape, head_pos);
-        }
-
-        // This function prints the tape with the head position
-        void print_tape(string tape, int head_pos) {
-            for (int i = 0; i < tape.size(); i++) {
-                if (i == head_pos) {
-                    cout << bold(underline(string(1, tape[i])));
-                } else {
-                    cout << tape[i];
-                }
-            }
-            cout << "####...";
-        }
-
-        // This function runs the Turing Machine on the input tape, prints the steps and the final tape
-        void run_TM(string tape, int head_pos) {
-            string state = this->initial_state;
-            cout << "==================================\n";
-            cout << bold("Running Turing Machine...") << endl;
-            while (true) {
-                char tape_symbol = tape[head_pos];
-                if (this->transitions.find(make_tuple(state, tape_symbol)) == this->transitions.end()) {
-                    cout << red("Error: No transition found for state " + state + " and symbol " + tape_symbol) << endl;
-                    break;
-                }
-
-                cout << "--> (" << state << ", ";
-                print_tape(tape, head_pos);
-                cout << ")" << endl;
-
-                tuple<string, char, char> transition = this->transitions[make_tuple(state, tape_symbol)];
-                string next_state = get<0>(transition);
-                char write_symbol = get<1>(transition);
-                char action = get<2>(transition);
-
-                tape[head_pos] = write_symbol;
-                if (action == 'L') {
-                    head_pos--;
-                } else if (action == 'R' ) {
-                    head_pos++;
-                } else if (action == 'Y') {
-                    cout << green("Accepted.") << endl;
-                    break;
-                } else if (action == 'N') {
-                    cout << red("Rejected.") << endl;
-                    break;
-                }
-
-                if (head_pos < 0) {
-                    cout << red("Error: Head position out of bounds.") << endl;
-                    break;
-                } else if (head_pos >= tape.size()) {
-                    tape.push_back('#');
-                }
-
-                state = next_state;
-            }
-            cout << "==================================\n";
-            cout << bold("Final tape: ") << endl;
-            print_tape(tape, head_pos);
-            cout << endl;
-        }
-
-        /* This function translates the Turing Machine to machine code
-        
-            Machine code format:
-            <state><tape_symbol><next_state><write_symbol><action>00<state><tape_symbol><next_state><write_symbol><action>00...
-
-            The machine code is generated using unary encoding.
-            Example:
-            States: {q0, q1, q2} ==> Unary encoding: {1, 11, 111}
-            Tape symbols: {#, 0, 1} ==> Unary encoding: {1, 11, 111}
-            Actions: {L, R, Y, N} ==> Unary encoding: {1, 11, 111, 1111}
-            Transition: (q0, 0) -> (q2, 1, R) ==> Unary encoding: 101101110111011
-        */
-        void translate_TM_to_machine_code() {
-            string machine_code;
-            auto it = this->transitions.begin();
-            while (it != this->transitions.end()) {
-                auto transition = *it;
-                string state = get<0>(transition.first);
-                char tape_symbol = get<1>(transition.first);
-                string next_state = get<0>(transition.second);
-                char write_symbol = get<1>(transition.second);
-                char action = get<2>(transition.second);
-
-                // Encode state
-                for (int i = 0; i < this->states.size(); i++) {
-                    if (state == *next(this->states.begin(), i)) {
-                        machine_code += string(i + 1, '1');
-                        break;
-                    }
-                }
-
-                machine_code += '0';
-
-                // Encode tape symbol
-                for (int i = 0; i < this->tape_symbols.size(); i++) {
-                    if (tape_symbol == *next(this->tape_symbols.begin(), i)) {
-                        machine_code += string(i + 1, '1');
-                        break;
-                    }
-                }
-
-                machine_code += '0';
-
-                // Encode next state
-                for (int i = 0; i < this->states.size(); i++) {
-                    if (next_state == *next(this->states.begin(), i)) {
-                        machine_code += string(i + 1, '1');
-                        break;
-                    }
-                }
-
-                machine_code += '0';
-
-                // Encode write symbol
-                for (int i = 0; i < this->tape_symbols.size(); i++) {
-                    if (write_symbol == *next(this->tape_symbols.begin(), i)) {
-                        machine_code += string(i + 1, '1');
-                        break;
-                    }
-                }
-
-                machine_code += '0';
-
-                // Encode action
-                if (action == 'L') {
-                    machine_code += "1";
-                } else if (action == 'R') {
-                    machine_code += "11";
-                } else if (action == 'Y') {
-                    machine_code += "111";
-                } else if (action == 'N') {
-                    machine_code += "1111";
-                }
-
-                it++;
-                if (it != this->transitions.end()) {
-                    machine_code += "00";
-                }
-            }
-
-            cout << bold("Encoded TM string (machine code):") << endl << machine_code << endl;
-            cout << "==================================\n";
-        }
-
-};
-
-int main() {
-    TuringMachine TM = TuringMachine();
-    TM.get_TM_specs_from_user();
-    TM.print_TM_specs();
-
-    TM.translate_TM_to_machine_code();
-
-    pair<string, int> tape = TM.get_input_tape();
-    TM.run_TM(tape.first, tape.second);
-
-
-    return 0;
-}
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <tuple>
+#include <string>
+#include <string_view>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <regex>
+
+#include "tape.h"
+
+using namespace std;
+
+
+/***************************************************************/
+/*********************** OUTPUT FORMATTING *********************/
+/***************************************************************/
+string bold(string str) {
+    return "\033[1m" + str + "\033[0m";
+}
+
+string underline(string str) {
+    return "\033[4m" + str + "\033[0m";
+}
+
+string red(string str) {
+    return "\033[31m" + str + "\033[0m";
+}
+
+string green(string str) {
+    return "\033[32m" + str + "\033[0m";
+}
+
+string cyan(string str) {
+    return "\033[36m" + str + "\033[0m";
+}
+
+/*****************************************************************/
+/************************ HELPER FUNCTIONS ***********************/
+/*****************************************************************/
+static inline void ltrim(std::string &s) {
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+        return !std::isspace(ch);
+    }));
+}
+
+static inline void rtrim(std::string &s) {
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
+        return !std::isspace(ch);
+    }).base(), s.end());
+}
+
+static inline void trim(std::string &s) {
+    ltrim(s);
+    rtrim(s);
+}
+
+static inline std::string ltrim_copy(std::string s) {
+    ltrim(s);
+    return s;
+}
+
+static inline std::string rtrim_copy(std::string s) {
+    rtrim(s);
+    return s;
+}
+
+static inline std::string trim_copy(std::string s) {
+    trim(s);
+    return s;
+}
+
+/*****************************************************************/
+/************************ INPUT FUNCTIONS ************************/
+/*****************************************************************/
+int take_valid_int_input(string prompt, int min_val = 1, int max_val = INT_MAX) {
+    int num;
+    string input;
+    while(true) {
+        cout << prompt;
+        cin >> input;
+        if (input.size() == 0) {}
+        else if (input.find_first_not_of("0123456789") != string::npos) {}
+        else if ((num = stoi(input)) >= min_val && num <= max_val) {
+            return num;
+        }
+        cout << red("Error: Invalid input.") << endl;
+    }
+}
+
+char take_valid_char_input(string prompt) {
+    char c;
+    string input;
+    while(true) {
+        cout << prompt;
+        cin >> input;
+        if (input.size() == 1) {
+            return input[0];
+        }
+        cout << red("Error: Invalid input.") << endl;
+    }
+}
+
+string take_valid_string_input(string prompt) {
+    string input;
+    while(true) {
+        cout << prompt;
+        cin >> input;
+        if (input.size() > 0) {
+            return input;
+        }
+        cout << red("Error: Invalid input.") << endl;
+    }
+}
+
+/*****************************************************************/
+/*********************** COMPILED MACHINE ************************/
+/*****************************************************************/
+/* A compiled machine interns states and tape symbols to small integer IDs
+   and stores the transition function as a flat [state][symbol] table.
+
+   Each table entry packs (next_state, write_symbol, action) into 32 bits:
+   [ next_state : 20 ][ write_symbol : 8 ][ action : 4 ]
+   so a step is a single array index with no string handling.
+*/
+enum Action : uint8_t { ACT_L = 0, ACT_R = 1, ACT_Y = 2, ACT_N = 3, ACT_NONE = 4 };
+
+enum Outcome { OUT_RUNNING, OUT_ACCEPT, OUT_REJECT, OUT_NO_TRANSITION, OUT_INVALID_TAPE, OUT_TIMEOUT, OUT_LOOP };
+
+// next_state has 20 bits in a packed entry, so no compiled machine may have more states
+const uint32_t MAX_STATES = 1u << 20;
+
+static inline uint32_t pack_transition(uint32_t next_state, uint8_t write_symbol, uint8_t action) {
+    return (next_state << 12) | (uint32_t(write_symbol) << 4) | action;
+}
+
+static inline uint32_t transition_next_state(uint32_t entry) {
+    return entry >> 12;
+}
+
+static inline uint8_t transition_write_symbol(uint32_t entry) {
+    return uint8_t(entry >> 4);
+}
+
+static inline uint8_t transition_action(uint32_t entry) {
+    return uint8_t(entry & 0xF);
+}
+
+static inline uint8_t action_code(char action) {
+    switch (action) {
+        case 'L': return ACT_L;
+        case 'R': return ACT_R;
+        case 'Y': return ACT_Y;
+        case 'N': return ACT_N;
+    }
+    return ACT_NONE;
+}
+
+string outcome_name(Outcome outcome) {
+    switch (outcome) {
+        case OUT_RUNNING: return "running";
+        case OUT_ACCEPT: return "accept";
+        case OUT_REJECT: return "reject";
+        case OUT_NO_TRANSITION: return "error";
+        case OUT_INVALID_TAPE: return "invalid";
+        case OUT_TIMEOUT: return "timeout";
+        case OUT_LOOP: return "loop";
+    }
+    return "error";
+}
+
+// The execution state of a run; outcome stays OUT_RUNNING until the machine halts
+struct RunResult {
+    Outcome outcome;
+    long long steps;
+    long long head_pos;
+    uint32_t state;
+};
+
+struct CompiledMachine {
+    vector<string> state_names;          // state ID -> state name
+    vector<char> symbols;                // symbol ID -> tape character
+    array<int16_t, 256> symbol_ids;      // tape character -> symbol ID, -1 if not interned
+    uint32_t n_states = 0;
+    uint32_t n_symbols = 0;
+    uint32_t initial_state = 0;
+    uint8_t blank = 0;
+    uint8_t left_mark = 0;
+    string tape_alphabet;                // the machine's tape symbols, accepted in input tapes
+    string input_alphabet;               // the machine's input symbols; empty when unknown (binary files)
+    const uint32_t *table = nullptr;     // [state * n_symbols + symbol] -> packed transition
+    shared_ptr<const void> table_owner;  // keeps the table alive: a heap vector or a mapped file
+
+    // Allocates an owned table of n_states * n_symbols copies of entry and returns it for writing
+    uint32_t *allocate_table(uint32_t entry) {
+        auto storage = make_shared<vector<uint32_t>>(size_t(this->n_states) * this->n_symbols, entry);
+        this->table = storage->data();
+        this->table_owner = storage;
+        return storage->data();
+    }
+
+    // Returns true when every character of an input tape (given without the left mark) is a tape symbol
+    bool check_valid_input(const string &tape) const {
+        for (char c : tape) {
+            if (this->tape_alphabet.find(c) == string::npos) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Bits per cell of a packed tape holding every symbol, or 0 when the machine needs byte cells
+    int packed_bits() const {
+        return (this->n_symbols <= 2) ? 1 : (this->n_symbols <= 4) ? 2 : (this->n_symbols <= 16) ? 4 : 0;
+    }
+
+    // Writes a tape of characters into cells 0..n-1 of a blank tape (a Tape or a PackedTape). Returns false on a character outside the alphabet.
+    template <class Cells>
+    bool encode_tape(const string &tape, Cells &cells) const {
+        cells.reset(this->blank);
+        for (size_t i = 0; i < tape.size(); i++) {
+            int16_t id = this->symbol_ids[(unsigned char)tape[i]];
+            if (id < 0) {
+                return false;
+            }
+            cells.set(i, uint8_t(id));
+        }
+        return true;
+    }
+
+    // Decodes the cells in [from, to) back into tape characters
+    template <class Cells>
+    string decode_tape(const Cells &cells, long long from, long long to) const {
+        string tape;
+        tape.reserve(max(0LL, to - from));
+        for (long long i = from; i < to; i++) {
+            tape += this->symbols[cells.get(i)];
+        }
+        return tape;
+    }
+
+    RunResult start(long long head_pos) const {
+        return {OUT_RUNNING, 0, head_pos, this->initial_state};
+    }
+
+    // This function advances a run silently until it halts or has taken step_limit steps in total
+    void advance(Tape &tape, RunResult &run, long long step_limit) const {
+        const uint32_t *tbl = this->table;
+        const uint32_t n_syms = this->n_symbols;
+        uint32_t state = run.state;
+        long long steps = run.steps;
+        long long page_start = Tape::page_start_of(run.head_pos);
+        long long offset = run.head_pos - page_start;
+        uint8_t *page = tape.page_at(page_start);
+        Outcome outcome = OUT_RUNNING;
+        while (steps < step_limit) {
+            uint8_t symbol = page[offset];
+            uint32_t entry = tbl[state * n_syms + symbol];
+            uint8_t action = transition_action(entry);
+            if (action == ACT_NONE) {
+                outcome = OUT_NO_TRANSITION;
+                break;
+            }
+            steps++;
+            uint8_t write_symbol = transition_write_symbol(entry);
+            if (write_symbol != symbol) {
+                if (tape.is_blank_page(page)) {
+                    page = tape.materialize(page_start);
+                }
+                page[offset] = write_symbol;
+            }
+            state = transition_next_state(entry);
+            if (action == ACT_R) {
+                if (++offset == Tape::PAGE_SIZE) {
+                    page_start += Tape::PAGE_SIZE;
+                    offset = 0;
+                    page = tape.page_at(page_start);
+                }
+            } else if (action == ACT_L) {
+                if (offset-- == 0) {
+                    page_start -= Tape::PAGE_SIZE;
+                    offset = Tape::PAGE_SIZE - 1;
+                    page = tape.page_at(page_start);
+                }
+            } else {
+                outcome = (action == ACT_Y) ? OUT_ACCEPT : OUT_REJECT;
+                break;
+            }
+        }
+        run = {outcome, steps, page_start + offset, state};
+    }
+
+    // This function runs the machine silently until it halts and returns the outcome
+    RunResult run(Tape &tape, long long head_pos) const {
+        RunResult result = start(head_pos);
+        advance(tape, result, LLONG_MAX);
+        return result;
+    }
+};
+
+/*****************************************************************/
+/************************* BINARY FORMAT *************************/
+/*****************************************************************/
+/* Compact, versioned binary serialization of a compiled machine.
+
+    Layout (varints are unsigned LEB128):
+    "TMBC"                                  magic
+    varint version                          BINARY_FORMAT_VERSION
+    varint n_symbols, n_symbols bytes       symbol table (symbol ID -> character)
+    varint blank, varint left_mark          symbol IDs
+    varint length, bytes                    tape alphabet accepted in input tapes
+    varint n_states                         followed by each state name as varint length + bytes
+    varint initial_state
+    zero padding to a 4-byte boundary
+    uint32[n_states * n_symbols]            the dense transition table, little-endian
+
+    The table is stored exactly as the engine uses it, so loading maps the file and points
+    the machine at it: the only work is reading the symbol and state tables and bounds-
+    checking the entries once.
+*/
+const uint32_t BINARY_FORMAT_VERSION = 1;
+
+static void write_varint(string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static bool read_varint(const uint8_t *&p, const uint8_t *end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_little_endian() {
+    uint32_t probe = 1;
+    return *reinterpret_cast<uint8_t *>(&probe) == 1;
+}
+
+bool save_binary(const CompiledMachine &cm, const string &path) {
+    string header = "TMBC";
+    write_varint(header, BINARY_FORMAT_VERSION);
+    write_varint(header, cm.n_symbols);
+    header.append(cm.symbols.begin(), cm.symbols.end());
+    write_varint(header, cm.blank);
+    write_varint(header, cm.left_mark);
+    write_varint(header, cm.tape_alphabet.size());
+    header += cm.tape_alphabet;
+    write_varint(header, cm.n_states);
+    for (const string &name : cm.state_names) {
+        write_varint(header, name.size());
+        header += name;
+    }
+    write_varint(header, cm.initial_state);
+    header.append((4 - header.size() % 4) % 4, '\0');
+
+    ofstream file(path, ios::binary);
+    if (!file || !is_little_endian()) {
+        cerr << red("Error: Cannot write binary machine " + path) << endl;
+        return false;
+    }
+    file.write(header.data(), header.size());
+    file.write(reinterpret_cast<const char *>(cm.table), size_t(cm.n_states) * cm.n_symbols * sizeof(uint32_t));
+    return bool(file);
+}
+
+bool is_binary_machine(const string &path) {
+    ifstream file(path, ios::binary);
+    char magic[4] = {0};
+    file.read(magic, 4);
+    return file && memcmp(magic, "TMBC", 4) == 0;
+}
+
+bool load_binary(const string &path, CompiledMachine &cm) {
+    auto fail = [&](string message) {
+        cerr << red("Error: " + path + ": " + message) << endl;
+        return false;
+    };
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return fail("Cannot open binary machine.");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 8) {
+        close(fd);
+        return fail("Truncated binary machine.");
+    }
+    size_t size = info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return fail("Cannot map binary machine.");
+    }
+    shared_ptr<const void> owner(mapping, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+
+    const uint8_t *base = static_cast<const uint8_t *>(mapping);
+    const uint8_t *p = base + 4, *end = base + size;
+    uint64_t version, n_symbols, blank, left_mark, alphabet_size, n_states, initial_state;
+    if (memcmp(base, "TMBC", 4) != 0 || !is_little_endian()) {
+        return fail("Not a binary machine.");
+    }
+    if (!read_varint(p, end, version) || version != BINARY_FORMAT_VERSION) {
+        return fail("Unsupported binary machine version.");
+    }
+
+    cm = CompiledMachine();
+    cm.symbol_ids.fill(-1);
+    if (!read_varint(p, end, n_symbols) || n_symbols == 0 || n_symbols > 256 || uint64_t(end - p) < n_symbols) {
+        return fail("Corrupt symbol table.");
+    }
+    cm.symbols.assign(p, p + n_symbols);
+    p += n_symbols;
+    for (uint32_t id = 0; id < n_symbols; id++) {
+        cm.symbol_ids[(unsigned char)cm.symbols[id]] = int16_t(id);
+    }
+    cm.n_symbols = n_symbols;
+    if (!read_varint(p, end, blank) || !read_varint(p, end, left_mark) || blank >= n_symbols || left_mark >= n_symbols ||
+        !read_varint(p, end, alphabet_size) || uint64_t(end - p) < alphabet_size) {
+        return fail("Corrupt symbol table.");
+    }
+    cm.blank = uint8_t(blank);
+    cm.left_mark = uint8_t(left_mark);
+    cm.tape_alphabet.assign(p, p + alphabet_size);
+    p += alphabet_size;
+
+    if (!read_varint(p, end, n_states) || n_states == 0) {
+        return fail("Corrupt state table.");
+    }
+    if (n_states > MAX_STATES) {
+        return fail("Too many states (at most " + to_string(MAX_STATES) + ").");
+    }
+    cm.n_states = n_states;
+    cm.state_names.reserve(n_states);
+    for (uint64_t i = 0; i < n_states; i++) {
+        uint64_t length;
+        if (!read_varint(p, end, length) || uint64_t(end - p) < length) {
+            return fail("Corrupt state table.");
+        }
+        cm.state_names.emplace_back(p, p + length);
+        p += length;
+    }
+    if (!read_varint(p, end, initial_state) || initial_state >= n_states) {
+        return fail("Corrupt initial state.");
+    }
+    cm.initial_state = initial_state;
+
+    size_t table_offset = (size_t(p - base) + 3) & ~size_t(3);
+    size_t n_entries = size_t(n_states) * n_symbols;
+    if (table_offset + n_entries * sizeof(uint32_t) != size) {
+        return fail("Transition table size does not match the header.");
+    }
+    const uint32_t *table = reinterpret_cast<const uint32_t *>(base + table_offset);
+    for (size_t i = 0; i < n_entries; i++) {
+        uint8_t action = transition_action(table[i]);
+        if (action > ACT_NONE || (action != ACT_NONE && (transition_next_state(table[i]) >= n_states || transition_write_symbol(table[i]) >= n_symbols))) {
+            return fail("Corrupt transition at entry " + to_string(i) + ".");
+        }
+    }
+    cm.table = table;
+    cm.table_owner = owner;
+    return true;
+}
+
+/*****************************************************************/
+/************************** FAST LOADER **************************/
+/*****************************************************************/
+/* Loads a definition file straight into a CompiledMachine (the format is described at TuringMachine::load_TM_specs_from_file).
+
+    The file is mapped, and each line is parsed once, as string_views into the
+    mapping, with no copies. States are interned as they are declared, in an
+    open-addressing hash table of state IDs; a lookup probes a flat array instead of
+    chasing list nodes. Transitions are collected sparsely. At the end, states and
+    symbols are numbered in sorted order and the transitions are written into the
+    dense table, so the result is identical to TuringMachine::compile() on the same
+    file. A missing transition stays ACT_NONE. Duplicates are found by sorting the
+    (state, symbol) keys. Parsing goes on after an error, and the errors are printed
+    at the end in line order, so one load reports all of them.
+
+    Nondeterministic definitions go through the TuringMachine loader.
+*/
+struct SparseTransition {
+    long long line_no;
+    uint32_t state;
+    uint32_t next_state;
+    char symbol;
+    char write_symbol;
+    uint8_t action;
+};
+
+class DefinitionLoader {
+
+    private:
+        string source;
+        long long line_no = 0;
+        vector<pair<long long, string>> errors;             // (line, message)
+
+        vector<string_view> state_names;                    // state ID (declaration order) -> name, views into the mapping
+        vector<uint32_t> slots;                             // hash table of state ID + 1, 0 = empty
+        bool input_symbols[256] = {false}, tape_symbols[256] = {false};
+        string_view initial_state;
+        vector<SparseTransition> transitions;
+
+        void report(string message, long long line = -1) {
+            this->errors.emplace_back((line < 0) ? this->line_no : line, message);
+        }
+
+        static uint64_t name_hash(string_view name) {
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            for (char c : name) {
+                hash = (hash ^ (unsigned char)c) * 0x100000001b3ULL;
+            }
+            return hash ^ (hash >> 29);
+        }
+
+        // Returns the slot holding name, or the empty slot where it belongs
+        size_t probe(string_view name) const {
+            size_t mask = this->slots.size() - 1;
+            for (size_t i = name_hash(name) & mask; ; i = (i + 1) & mask) {
+                uint32_t id = this->slots[i];
+                if (id == 0 || this->state_names[id - 1] == name) {
+                    return i;
+                }
+            }
+        }
+
+        // Adds a state; returns false if it was already declared
+        bool intern(string_view name) {
+            if (2 * (this->state_names.size() + 1) > this->slots.size()) {
+                vector<uint32_t> old;
+                old.swap(this->slots);
+                this->slots.assign(max<size_t>(64, 2 * old.size()), 0);
+                for (uint32_t id : old) {
+                    if (id != 0) {
+                        this->slots[probe(this->state_names[id - 1])] = id;
+                    }
+                }
+            }
+            size_t slot = probe(name);
+            if (this->slots[slot] != 0) {
+                return false;
+            }
+            this->state_names.push_back(name);
+            this->slots[slot] = uint32_t(this->state_names.size());
+            return true;
+        }
+
+        static string_view trim_view(string_view text) {
+            size_t first = 0, last = text.size();
+            while (first < last && isspace((unsigned char)text[first])) {
+                first++;
+            }
+            while (last > first && isspace((unsigned char)text[last - 1])) {
+                last--;
+            }
+            return text.substr(first, last - first);
+        }
+
+        // Splits off the next whitespace-separated value; returns an empty view at the end
+        static string_view next_value(string_view &text) {
+            text = trim_view(text);
+            size_t end = 0;
+            while (end < text.size() && !isspace((unsigned char)text[end])) {
+                end++;
+            }
+            string_view value = text.substr(0, end);
+            text.remove_prefix(end);
+            return value;
+        }
+
+        // Parses "(a,b)" or "(a,b,c)" into n trimmed fields
+        static bool split_tuple(string_view text, string_view *fields, int n) {
+            if (text.size() < 2 || text.front() != '(' || text.back() != ')') {
+                return false;
+            }
+            text = text.substr(1, text.size() - 2);
+            for (int i = 0; i < n; i++) {
+                size_t comma = (i + 1 < n) ? text.find(',') : text.size();
+                if (comma == string_view::npos || (i + 1 == n && text.find(',') != string_view::npos)) {
+                    return false;
+                }
+                fields[i] = trim_view(text.substr(0, comma));
+                text.remove_prefix(min(text.size(), comma + 1));
+            }
+            return true;
+        }
+
+        bool find_state(string_view name, uint32_t &id) const {
+            if (this->slots.empty()) {
+                return false;
+            }
+            uint32_t found = this->slots[probe(name)];
+            id = found - 1;
+            return found != 0;
+        }
+
+        bool is_tape_symbol(string_view symbol) const {
+            return symbol.size() == 1 && this->tape_symbols[(unsigned char)symbol[0]];
+        }
+
+        void parse_transition(string_view line) {
+            size_t close = line.find(')');
+            size_t arrow = line.find("->");
+            string_view from[2], to[3];
+            if (close == string_view::npos || arrow == string_view::npos || arrow < close ||
+                !split_tuple(line.substr(0, close + 1), from, 2) || !trim_view(line.substr(close + 1, arrow - close - 1)).empty() ||
+                !split_tuple(trim_view(line.substr(arrow + 2)), to, 3)) {
+                report("Invalid transition.");
+                return;
+            }
+            SparseTransition t;
+            t.line_no = this->line_no;
+            t.action = (to[2].size() == 1) ? action_code(char(toupper((unsigned char)to[2][0]))) : uint8_t(ACT_NONE);
+            if (!find_state(from[0], t.state)) {
+                report("Unrecognized state " + string(from[0]) + ".");
+            } else if (!is_tape_symbol(from[1])) {
+                report("Unrecognized tape symbol " + string(from[1]) + ".");
+            } else if (!find_state(to[0], t.next_state) || !is_tape_symbol(to[1]) || t.action == ACT_NONE) {
+                report("Invalid transition.");
+            } else {
+                t.symbol = from[1][0];
+                t.write_symbol = to[1][0];
+                this->transitions.push_back(t);
+            }
+        }
+
+        void parse_key(string_view line) {
+            size_t colon = line.find(':');
+            if (colon == string_view::npos) {
+                report("Expected 'key: values' or a transition.");
+                return;
+            }
+            string_view key = trim_view(line.substr(0, colon));
+            string_view values = line.substr(colon + 1);
+            if (key == "states") {
+                for (string_view value = next_value(values); !value.empty(); value = next_value(values)) {
+                    if (!intern(value)) {
+                        report("Invalid state " + string(value) + ".");
+                    }
+                }
+            } else if (key == "input" || key == "tape") {
+                bool *symbol_set = (key == "input") ? this->input_symbols : this->tape_symbols;
+                for (string_view value = next_value(values); !value.empty(); value = next_value(values)) {
+                    if (value.size() != 1 || symbol_set[(unsigned char)value[0]]) {
+                        report("Invalid symbol " + string(value) + ".");
+                    }
+                    symbol_set[(unsigned char)value[0]] = true;
+                }
+            } else if (key == "initial") {
+                this->initial_state = next_value(values);
+                uint32_t id;
+                if (!find_state(this->initial_state, id)) {
+                    report("Unrecognized initial state " + string(this->initial_state) + ".");
+                }
+            } else {
+                report("Unknown key " + string(key) + ".");
+            }
+        }
+
+        void parse(string_view text) {
+            while (!text.empty()) {
+                size_t end = text.find('\n');
+                string_view line = trim_view(text.substr(0, end));
+                text.remove_prefix(end == string_view::npos ? text.size() : end + 1);
+                this->line_no++;
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+                if (line[0] == '(') {
+                    parse_transition(line);
+                } else {
+                    parse_key(line);
+                }
+            }
+        }
+
+        bool finish(CompiledMachine &cm) {
+            if (this->state_names.empty()) {
+                report("No states defined.");
+            } else if (this->state_names.size() > MAX_STATES) {
+                report("Too many states (at most " + to_string(MAX_STATES) + ").");
+            }
+            if (this->initial_state.empty()) {
+                report("No initial state defined.");
+            }
+            for (int c = 0; c < 256; c++) {
+                if (this->input_symbols[c] && !this->tape_symbols[c]) {
+                    report("Input symbols must be a subset of tape symbols.");
+                    break;
+                }
+            }
+            // Sorting the (state, symbol) keys puts every repeated transition right after the one it repeats
+            vector<pair<uint64_t, size_t>> keys(this->transitions.size());
+            for (size_t i = 0; i < keys.size(); i++) {
+                keys[i] = make_pair((uint64_t(this->transitions[i].state) << 8) | (unsigned char)this->transitions[i].symbol, i);
+            }
+            sort(keys.begin(), keys.end());
+            for (size_t i = 1; i < keys.size(); i++) {
+                if (keys[i].first == keys[i - 1].first) {
+                    const SparseTransition &t = this->transitions[keys[i].second];
+                    report("Duplicate transition for (" + string(this->state_names[t.state]) + "," + t.symbol + ").", t.line_no);
+                }
+            }
+            if (!this->errors.empty()) {
+                return false;
+            }
+
+            // Number the states in sorted order, as compile() does
+            cm = CompiledMachine();
+            cm.symbol_ids.fill(-1);
+            vector<uint32_t> order(this->state_names.size()), rank(this->state_names.size());
+            for (uint32_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+            sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return this->state_names[a] < this->state_names[b];
+            });
+            cm.state_names.reserve(order.size());
+            for (uint32_t i = 0; i < order.size(); i++) {
+                rank[order[i]] = i;
+                cm.state_names.emplace_back(this->state_names[order[i]]);
+            }
+            cm.n_states = order.size();
+
+            for (int c = 0; c < 256; c++) {
+                if (this->tape_symbols[c] || c == '#' || c == '<') {
+                    cm.symbol_ids[c] = int16_t(cm.symbols.size());
+                    cm.symbols.push_back(char(c));
+                }
+                if (this->tape_symbols[c]) {
+                    cm.tape_alphabet += char(c);
+                }
+                if (this->input_symbols[c]) {
+                    cm.input_alphabet += char(c);
+                }
+            }
+            cm.n_symbols = cm.symbols.size();
+            cm.blank = uint8_t(cm.symbol_ids['#']);
+            cm.left_mark = uint8_t(cm.symbol_ids['<']);
+            uint32_t initial = 0;
+            find_state(this->initial_state, initial);
+            cm.initial_state = rank[initial];
+
+            uint32_t *table = cm.allocate_table(pack_transition(0, 0, ACT_NONE));
+            for (const SparseTransition &t : this->transitions) {
+                size_t entry = size_t(rank[t.state]) * cm.n_symbols + cm.symbol_ids[(unsigned char)t.symbol];
+                table[entry] = pack_transition(rank[t.next_state], uint8_t(cm.symbol_ids[(unsigned char)t.write_symbol]), t.action);
+            }
+            return true;
+        }
+
+        bool print_errors() {
+            stable_sort(this->errors.begin(), this->errors.end(), [](const pair<long long, string> &a, const pair<long long, string> &b) {
+                return a.first < b.first;
+            });
+            for (auto &error : this->errors) {
+                cerr << red("Error: " + this->source + ":" + to_string(error.first) + ": " + error.second) << endl;
+            }
+            return this->errors.empty();
+        }
+
+    public:
+        // This function loads the definition file at path into cm. Errors are reported to stderr.
+        bool load(const string &path, CompiledMachine &cm) {
+            this->source = path;
+            int fd = open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                cerr << red("Error: Cannot open machine definition " + path) << endl;
+                return false;
+            }
+            size_t size = info.st_size;
+            void *mapping = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                cerr << red("Error: Cannot map machine definition " + path) << endl;
+                return false;
+            }
+            shared_ptr<const void> owner(mapping, [size](const void *p) {
+                if (p) {
+                    munmap(const_cast<void *>(p), size);
+                }
+            });
+            parse(string_view(static_cast<const char *>(mapping), size));
+            finish(cm);
+            return print_errors();
+        }
+};
+
+/*****************************************************************/
+/************************* UNARY DECODER *************************/
+/*****************************************************************/
+/* Streaming decoder for the unary machine code produced by translate_TM_to_machine_code.
+
+    Reads one transition at a time from a stream, so codes larger than memory can be
+    decoded. Fields are 1-based unary indices: (state, tape symbol, next state, write
+    symbol, action) separated by a single 0, and transitions separated by 00.
+*/
+struct UnaryTransition {
+    uint64_t state, tape_symbol, next_state, write_symbol, action;
+};
+
+class UnaryDecoder {
+
+    private:
+        istream &in;
+        string error;
+        long long position = 0;
+        bool finished = false;
+
+        int peek() {
+            int c = this->in.peek();
+            return (c == '0' || c == '1') ? c : EOF;
+        }
+
+        // Reads a run of 1s and returns its length (0 when the run is empty)
+        uint64_t read_run() {
+            uint64_t length = 0;
+            while (peek() == '1') {
+                this->in.get();
+                this->position++;
+                length++;
+            }
+            return length;
+        }
+
+        bool expect_zero() {
+            if (peek() != '0') {
+                return false;
+            }
+            this->in.get();
+            this->position++;
+            return true;
+        }
+
+    public:
+        explicit UnaryDecoder(istream &in) : in(in) {}
+
+        const string &get_error() const {
+            return this->error;
+        }
+
+        // Decodes the next transition. Returns false at the end of the code or on an error.
+        bool next(UnaryTransition &t) {
+            if (this->finished || peek() == EOF) {
+                return false;
+            }
+            uint64_t *fields[5] = {&t.state, &t.tape_symbol, &t.next_state, &t.write_symbol, &t.action};
+            for (int i = 0; i < 5; i++) {
+                *fields[i] = read_run();
+                if (*fields[i] == 0 || (i < 4 && !expect_zero())) {
+                    this->error = "Malformed machine code at position " + to_string(this->position) + ".";
+                    this->finished = true;
+                    return false;
+                }
+            }
+            if (t.action > 4) {
+                this->error = "Invalid action at position " + to_string(this->position) + ".";
+                this->finished = true;
+                return false;
+            }
+            if (peek() == EOF) {
+                this->finished = true;
+            } else if (!expect_zero() || !expect_zero()) {
+                this->error = "Expected transition separator 00 at position " + to_string(this->position) + ".";
+                this->finished = true;
+            }
+            return true;
+        }
+};
+
+/*****************************************************************/
+/*********************** ACCELERATED ENGINE **********************/
+/*****************************************************************/
+/* Macro-step execution for long-running machines.
+
+    The tape is viewed as k-cell blocks (k divides the page size, so a block never
+    straddles pages). When the head sits on the first or last cell of a block, the
+    engine looks up (state, block contents, entry side) in a memo table that holds
+    the result of simulating the machine inside that block until the head leaves it:
+    (next state, new block contents, exit side, steps). A miss simulates the block
+    once on a local copy. Blocks in which the machine halts, or which do not exit
+    within a step cap, are left to the naive engine, so halting configurations and
+    step limits are always reached exactly.
+
+    When a block is passed straight through in the same state, the following blocks
+    with identical contents are swept in bulk without lookups, and an unwritten page
+    is crossed in one jump. The final tape, state, head position and step count are
+    the same as the naive engine's.
+*/
+class AcceleratedEngine {
+
+    private:
+        enum Exit : uint8_t { EXIT_LEFT, EXIT_RIGHT, EXIT_NAIVE };
+
+        struct MacroResult {
+            uint64_t contents;
+            long long steps;
+            uint32_t state;
+            Exit exit;
+        };
+
+        const CompiledMachine &cm;
+        int bits;                           // bits per packed cell
+        int k;                              // block size in cells
+        long long step_cap;                 // in-block steps before giving up on a block
+        unordered_map<uint64_t, MacroResult> memo;
+
+        static const size_t MAX_MEMO_ENTRIES = 1 << 20;
+        static const long long MIN_STEPS_PER_LOOKUP = 8;
+
+        uint64_t pack(const uint8_t *block) const {
+            uint64_t contents = 0;
+            for (int i = 0; i < this->k; i++) {
+                contents |= uint64_t(block[i]) << (i * this->bits);
+            }
+            return contents;
+        }
+
+        void unpack(uint64_t contents, uint8_t *block) const {
+            uint64_t mask = (1ULL << this->bits) - 1;
+            for (int i = 0; i < this->k; i++) {
+                block[i] = uint8_t((contents >> (i * this->bits)) & mask);
+            }
+        }
+
+        // Simulates the machine inside one block until the head leaves it
+        MacroResult simulate_block(uint32_t state, uint64_t contents, int side) const {
+            uint8_t cells[16];
+            unpack(contents, cells);
+            int pos = (side == EXIT_LEFT) ? 0 : this->k - 1;
+            long long steps = 0;
+            while (steps < this->step_cap) {
+                uint32_t entry = this->cm.table[size_t(state) * this->cm.n_symbols + cells[pos]];
+                uint8_t action = transition_action(entry);
+                if (action != ACT_L && action != ACT_R) {
+                    break;
+                }
+                steps++;
+                cells[pos] = transition_write_symbol(entry);
+                state = transition_next_state(entry);
+                pos += (action == ACT_R) ? 1 : -1;
+                if (pos < 0 || pos == this->k) {
+                    return {pack(cells), steps, state, (pos < 0) ? EXIT_LEFT : EXIT_RIGHT};
+                }
+            }
+            return {contents, steps, state, EXIT_NAIVE};
+        }
+
+    public:
+        explicit AcceleratedEngine(const CompiledMachine &cm) : cm(cm) {
+            this->bits = 1;
+            while ((1u << this->bits) < cm.n_symbols) {
+                this->bits++;
+            }
+            this->k = 16;
+            while (this->k * this->bits > 40) {
+                this->k /= 2;
+            }
+            this->step_cap = 64LL * this->k;
+        }
+
+        int block_size() const {
+            return this->k;
+        }
+
+        // This function advances a run until it halts or has taken step_limit steps in total
+        void advance(Tape &tape, RunResult &run, long long step_limit) {
+            const long long k = this->k;
+            long long window_start = run.steps;
+            long long lookups = 0;
+            long long backoff = 1 << 16;
+            while (run.outcome == OUT_RUNNING && run.steps < step_limit) {
+                // Macro steps only pay off when a lookup covers several steps; otherwise run naive for a while
+                if (++lookups == 4096) {
+                    if (run.steps - window_start < 4096 * MIN_STEPS_PER_LOOKUP) {
+                        this->cm.advance(tape, run, min(step_limit, run.steps + backoff));
+                        backoff = min(backoff * 2, 1LL << 26);
+                    } else {
+                        backoff = 1 << 16;
+                    }
+                    window_start = run.steps;
+                    lookups = 0;
+                    continue;
+                }
+
+                long long offset = run.head_pos & (k - 1);
+                if (offset != 0 && offset != k - 1) {
+                    this->cm.advance(tape, run, run.steps + 1);
+                    continue;
+                }
+                int side = (offset == 0) ? EXIT_LEFT : EXIT_RIGHT;
+                long long block_pos = run.head_pos - offset;
+                long long page_start = Tape::page_start_of(block_pos);
+                uint8_t *page = tape.page_at(page_start);
+                uint8_t *block = page + (block_pos - page_start);
+                uint64_t contents = pack(block);
+
+                uint64_t key = (uint64_t(run.state) << 41) | (uint64_t(side) << 40) | contents;
+                auto it = this->memo.find(key);
+                if (it == this->memo.end()) {
+                    if (this->memo.size() >= MAX_MEMO_ENTRIES) {
+                        this->memo.clear();
+                    }
+                    it = this->memo.emplace(key, simulate_block(run.state, contents, side)).first;
+                }
+                const MacroResult result = it->second;
+                if (result.exit == EXIT_NAIVE || run.steps + result.steps > step_limit) {
+                    this->cm.advance(tape, run, min(step_limit, run.steps + max(result.steps, this->step_cap)));
+                    continue;
+                }
+
+                bool changes = (result.contents != contents);
+                if (changes) {
+                    if (tape.is_blank_page(page)) {
+                        page = tape.materialize(page_start);
+                        block = page + (block_pos - page_start);
+                    }
+                    unpack(result.contents, block);
+                }
+                run.steps += result.steps;
+                bool passes_through = (result.state == run.state) && (result.exit != side);
+                run.state = result.state;
+                long long direction = (result.exit == EXIT_RIGHT) ? 1 : -1;
+                run.head_pos = (direction > 0) ? block_pos + k : block_pos - 1;
+                if (!passes_through) {
+                    continue;
+                }
+
+                // The next block is entered on the same side in the same state: identical blocks repeat the result
+                long long remaining_blocks = (direction > 0) ? (page_start + Tape::PAGE_SIZE - block_pos) / k - 1
+                                                             : (block_pos - page_start) / k;
+                long long affordable = (result.steps > 0) ? (step_limit - run.steps) / result.steps : remaining_blocks;
+                long long repeat = min(remaining_blocks, affordable);
+                if (tape.is_blank_page(page) && !changes) {
+                    run.steps += repeat * result.steps;
+                    run.head_pos += direction * repeat * k;
+                    continue;
+                }
+                uint8_t original[16], rewritten[16];
+                unpack(contents, original);
+                memcpy(rewritten, block, k);
+                uint8_t *next = block + direction * k;
+                long long r = 0;
+                while (r < repeat && memcmp(next, original, k) == 0) {
+                    if (changes) {
+                        memcpy(next, rewritten, k);
+                    }
+                    next += direction * k;
+                    r++;
+                }
+                run.steps += r * result.steps;
+                run.head_pos += direction * r * k;
+            }
+        }
+};
+
+/*****************************************************************/
+/**************************** TRACING ****************************/
+/*****************************************************************/
+/* Trace levels:
+    none    - only the final result is reported, the run has no per-step I/O
+    sampled - the configuration is emitted every Nth step
+    full    - every step is emitted
+
+    Trace lines go through a buffered writer and only show the cell that changed and
+    a window around the head, so a step costs O(window) output instead of O(tape).
+    Output is plain text when the target is not a TTY.
+*/
+enum TraceLevel { TRACE_NONE, TRACE_SAMPLED, TRACE_FULL };
+
+enum Engine { ENGINE_NAIVE, ENGINE_ACCELERATED };
+
+// TAPE_AUTO runs on bytes and moves to a packed tape once the tape is large
+enum TapeMode { TAPE_AUTO, TAPE_BYTES, TAPE_PACKED };
+
+struct RunOptions {
+    TraceLevel trace = TRACE_NONE;
+    long long sample_every = 1000;
+    Engine engine = ENGINE_NAIVE;
+    long long max_steps = 0;            // 0 = unlimited; reaching it ends the run with OUT_TIMEOUT
+    double time_limit = 0;              // seconds, 0 = unlimited; checked every check_stride steps
+    bool detect_loops = false;          // prove non-halting every check_stride steps (OUT_LOOP)
+    long long check_stride = 1 << 16;
+    TapeMode tape_mode = TAPE_AUTO;     // which cells the naive engine runs on (see run_packed)
+};
+
+// Parses "naive" or "accel" into the run options
+bool parse_engine_option(string value, RunOptions &options) {
+    if (value == "naive") {
+        options.engine = ENGINE_NAIVE;
+    } else if (value == "accel") {
+        options.engine = ENGINE_ACCELERATED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses "none", "full" or "sampled:N" into the run options
+bool parse_trace_option(string value, RunOptions &options) {
+    if (value == "none") {
+        options.trace = TRACE_NONE;
+    } else if (value == "full") {
+        options.trace = TRACE_FULL;
+    } else if (value.rfind("sampled", 0) == 0) {
+        options.trace = TRACE_SAMPLED;
+        if (value.size() > 8 && value[7] == ':' && value.find_first_not_of("0123456789", 8) == string::npos) {
+            options.sample_every = stoll(value.substr(8));
+        } else if (value.size() != 7) {
+            return false;
+        }
+        return options.sample_every > 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+class TraceWriter {
+
+    private:
+        FILE *out;
+        bool color;
+        int window;
+        string buffer;
+
+        void append_cell(char symbol, bool is_head) {
+            if (!is_head) {
+                buffer += symbol;
+            } else if (color) {
+                buffer += bold(underline(string(1, symbol)));
+            } else {
+                buffer += '[';
+                buffer += symbol;
+                buffer += ']';
+            }
+        }
+
+    public:
+        TraceWriter(FILE *out = stdout, int window = 10) : out(out), window(window) {
+            this->color = isatty(fileno(out));
+            this->buffer.reserve(1 << 16);
+        }
+
+        ~TraceWriter() {
+            flush();
+        }
+
+        // Emits one configuration: step count, state, the changed cell (if any) and the head window
+        void emit(const CompiledMachine &cm, const Tape &tape, const RunResult &run,
+                  bool changed = false, long long changed_pos = 0, uint8_t old_symbol = 0) {
+            buffer += to_string(run.steps);
+            buffer += ": (";
+            buffer += cm.state_names[run.state];
+            buffer += ", ...";
+            for (long long i = run.head_pos - window; i <= run.head_pos + window; i++) {
+                append_cell(cm.symbols[tape.get(i)], i == run.head_pos);
+            }
+            buffer += "...)";
+            if (changed && tape.get(changed_pos) != old_symbol) {
+                buffer += " [";
+                buffer += to_string(changed_pos);
+                buffer += "] ";
+                buffer += cm.symbols[old_symbol];
+                buffer += "->";
+                buffer += cm.symbols[tape.get(changed_pos)];
+            }
+            buffer += '\n';
+            if (buffer.size() >= (1 << 16) - 256) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (!buffer.empty()) {
+                fwrite(buffer.data(), 1, buffer.size(), out);
+                buffer.clear();
+            }
+            fflush(out);
+        }
+};
+
+/*****************************************************************/
+/************************ LOOP DETECTION *************************/
+/*****************************************************************/
+/* Proves that a run never halts. Both checks run between chunks of check_stride steps,
+    never inside the hot loop.
+
+    Repeated configurations: following Brent's algorithm, a snapshot of the whole
+    configuration (state, head, non-blank pages) is taken after 1, 2, 4, 8, ... checks
+    and every check compares the current configuration against it. A deterministic
+    machine that repeats a configuration loops forever. Since checks happen at multiples
+    of the stride, any cycle is found once the snapshot interval exceeds lcm(period, stride).
+
+    Escapes: a state escapes right if, reading only blanks, it keeps moving right until
+    it revisits a state (whatever it writes, the head never comes back to it). When the
+    head is right of every non-blank cell in such a state, the machine walks off to
+    infinity. Escaping left is symmetric. This catches translated cycles over blank tape.
+*/
+class LoopDetector {
+
+    private:
+        const CompiledMachine &cm;
+        vector<bool> escapes[2];            // [ACT_L], [ACT_R]
+
+        bool has_snapshot = false;
+        uint32_t snapshot_state = 0;
+        long long snapshot_head = 0;
+        vector<pair<long long, vector<uint8_t>>> snapshot_pages;
+        long long checks_since_snapshot = 0;
+        long long snapshot_interval = 1;
+
+        bool escapes_from(uint32_t state, uint8_t direction) const {
+            vector<bool> visited(this->cm.n_states, false);
+            while (!visited[state]) {
+                visited[state] = true;
+                uint32_t entry = this->cm.table[size_t(state) * this->cm.n_symbols + this->cm.blank];
+                if (transition_action(entry) != direction) {
+                    return false;
+                }
+                state = transition_next_state(entry);
+            }
+            return true;
+        }
+
+        static bool is_blank_run(const uint8_t *cells, long long n, uint8_t blank) {
+            for (long long i = 0; i < n; i++) {
+                if (cells[i] != blank) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // True when every cell strictly beyond the head in the escape direction is blank
+        bool only_blanks_beyond(Tape &tape, long long head, uint8_t direction) const {
+            if (tape.page_count() == 0) {
+                return true;
+            }
+            if (direction == ACT_R) {
+                long long last = tape.highest_page_start();
+                if (head >= last + Tape::PAGE_SIZE - 1) {
+                    return true;
+                }
+                if (head < last) {
+                    return false;
+                }
+                return is_blank_run(tape.page_at(last) + (head - last) + 1, last + Tape::PAGE_SIZE - head - 1, tape.blank_symbol());
+            } else {
+                long long first = tape.lowest_page_start();
+                if (head <= first) {
+                    return true;
+                }
+                if (head >= first + Tape::PAGE_SIZE) {
+                    return false;
+                }
+                return is_blank_run(tape.page_at(first), head - first, tape.blank_symbol());
+            }
+        }
+
+        bool matches_snapshot(const Tape &tape, const RunResult &run) const {
+            if (run.state != this->snapshot_state || run.head_pos != this->snapshot_head) {
+                return false;
+            }
+            size_t i = 0;
+            for (const TapeSegment &segment : tape.segments()) {
+                if (is_blank_run(segment.cells, segment.size, tape.blank_symbol())) {
+                    continue;
+                }
+                if (i == this->snapshot_pages.size() || this->snapshot_pages[i].first != segment.start ||
+                    memcmp(this->snapshot_pages[i].second.data(), segment.cells, segment.size) != 0) {
+                    return false;
+                }
+                i++;
+            }
+            return i == this->snapshot_pages.size();
+        }
+
+        void take_snapshot(const Tape &tape, const RunResult &run) {
+            this->has_snapshot = true;
+            this->snapshot_state = run.state;
+            this->snapshot_head = run.head_pos;
+            this->snapshot_pages.clear();
+            for (const TapeSegment &segment : tape.segments()) {
+                if (!is_blank_run(segment.cells, segment.size, tape.blank_symbol())) {
+                    this->snapshot_pages.emplace_back(segment.start, vector<uint8_t>(segment.cells, segment.cells + segment.size));
+                }
+            }
+        }
+
+    public:
+        explicit LoopDetector(const CompiledMachine &cm) : cm(cm) {
+            reset();
+        }
+
+        // Starts over for a new run, recomputing the escapes in case the machine's table was rewritten
+        void reset() {
+            for (uint8_t direction : {ACT_L, ACT_R}) {
+                this->escapes[direction].resize(this->cm.n_states);
+                for (uint32_t state = 0; state < this->cm.n_states; state++) {
+                    this->escapes[direction][state] = escapes_from(state, direction);
+                }
+            }
+            this->has_snapshot = false;
+            this->checks_since_snapshot = 0;
+            this->snapshot_interval = 1;
+        }
+
+        // Returns true when the run provably never halts
+        bool proves_loop(Tape &tape, const RunResult &run) {
+            for (uint8_t direction : {ACT_L, ACT_R}) {
+                if (this->escapes[direction][run.state] && only_blanks_beyond(tape, run.head_pos, direction)) {
+                    // The head cell itself must be blank too, since the escape chain starts by reading it
+                    if (tape.get(run.head_pos) == tape.blank_symbol()) {
+                        return true;
+                    }
+                }
+            }
+
+            if (this->has_snapshot && matches_snapshot(tape, run)) {
+                return true;
+            }
+            if (!this->has_snapshot || ++this->checks_since_snapshot == this->snapshot_interval) {
+                take_snapshot(tape, run);
+                this->checks_since_snapshot = 0;
+                this->snapshot_interval *= 2;
+            }
+            return false;
+        }
+};
+
+/*****************************************************************/
+/**************************** RUNNING ****************************/
+/*****************************************************************/
+/* This function runs a compiled machine until it halts, emitting trace lines according to the options.
+
+    Without tracing, time limits or loop detection the run is a single call into the
+    engine's hot loop (bounded by max_steps). Otherwise the run proceeds in chunks that
+    end at sample points and at multiples of check_stride, where the clock and the loop
+    detector are consulted. A run that exhausts max_steps or time_limit ends with
+    OUT_TIMEOUT; a run proved not to halt ends with OUT_LOOP.
+*/
+RunResult run_machine(const CompiledMachine &cm, Tape &tape, long long head_pos,
+                      const RunOptions &options, TraceWriter *writer = nullptr) {
+    RunResult run = cm.start(head_pos);
+    bool accelerated = (options.engine == ENGINE_ACCELERATED && options.trace != TRACE_FULL);
+    AcceleratedEngine accelerator(cm);
+    auto advance = [&](long long step_limit) {
+        if (accelerated) {
+            accelerator.advance(tape, run, step_limit);
+        } else {
+            cm.advance(tape, run, step_limit);
+        }
+    };
+
+    long long step_limit = (options.max_steps > 0) ? options.max_steps : LLONG_MAX;
+    TraceLevel trace = (writer == nullptr) ? TRACE_NONE : options.trace;
+    bool checking = (options.time_limit > 0 || options.detect_loops);
+    if (trace == TRACE_NONE && !checking) {
+        advance(step_limit);
+        if (run.outcome == OUT_RUNNING) {
+            run.outcome = OUT_TIMEOUT;
+        }
+        return run;
+    }
+
+    unique_ptr<LoopDetector> detector;
+    if (options.detect_loops) {
+        detector.reset(new LoopDetector(cm));
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::duration<double>(options.time_limit);
+    long long next_check = options.check_stride;
+    long long next_sample = options.sample_every;
+
+    if (trace != TRACE_NONE) {
+        writer->emit(cm, tape, run);
+    }
+    while (run.outcome == OUT_RUNNING && run.steps < step_limit) {
+        if (trace == TRACE_FULL) {
+            long long pos = run.head_pos;
+            uint8_t old_symbol = tape.get(pos);
+            advance(run.steps + 1);
+            if (run.outcome != OUT_NO_TRANSITION) {
+                writer->emit(cm, tape, run, true, pos, old_symbol);
+            }
+        } else {
+            long long target = step_limit;
+            if (checking) {
+                target = min(target, next_check);
+            }
+            if (trace == TRACE_SAMPLED) {
+                target = min(target, next_sample);
+            }
+            advance(target);
+            if (trace == TRACE_SAMPLED && (run.steps >= next_sample || run.outcome != OUT_RUNNING)) {
+                writer->emit(cm, tape, run);
+                next_sample = run.steps + options.sample_every;
+            }
+        }
+
+        if (checking && run.steps >= next_check && run.outcome == OUT_RUNNING) {
+            next_check += options.check_stride;
+            if (options.time_limit > 0 && chrono::steady_clock::now() >= deadline) {
+                run.outcome = OUT_TIMEOUT;
+            } else if (detector && detector->proves_loop(tape, run)) {
+                run.outcome = OUT_LOOP;
+            }
+        }
+    }
+    if (run.outcome == OUT_RUNNING) {
+        run.outcome = OUT_TIMEOUT;
+    }
+    if (trace == TRACE_SAMPLED && (run.outcome == OUT_TIMEOUT || run.outcome == OUT_LOOP)) {
+        writer->emit(cm, tape, run);
+    }
+    if (writer != nullptr) {
+        writer->flush();
+    }
+    return run;
+}
+
+/*****************************************************************/
+/************************* PACKED ENGINE *************************/
+/*****************************************************************/
+/* The naive engine on a PackedTape, for machines with at most 16 symbols.
+
+    CompiledMachine::packed_bits() picks the narrowest cell width that holds every
+    symbol: 1, 2 or 4 bits, against 8 on a Tape. The loop is the naive loop with
+    reads and writes through shift and mask, plus sweeps. A sweep is a transition that
+    keeps the state, rewrites the symbol it read and moves; it repeats on every
+    following cell that holds the same symbol. After SWEEP_THRESHOLD such steps in a
+    row, the head jumps straight to the first other cell (PackedTape::find_other) and
+    the steps are added in bulk, so a machine that sweeps long uniform regions costs
+    a word per 16 to 64 cells. Step counts and final configurations match naive.
+
+    A jump never takes the head beyond ±2^62. Past that, a sweep over blank tape (a
+    run that never halts) goes cell by cell like the naive engine.
+
+    A step costs more on packed cells than on bytes, so by default (TAPE_AUTO) a run
+    starts on a Tape and moves to a PackedTape only once it has written more than
+    PACKED_MIN_PAGES pages (4 MB). Past that size the packed tape's smaller footprint
+    and sweeps pay for themselves. --packed-tape starts on packed cells and
+    --byte-tape never leaves bytes. Runs that trace, detect loops or use the
+    accelerated engine stay on a Tape.
+*/
+const long long SWEEP_THRESHOLD = 8;
+const size_t PACKED_MIN_PAGES = 1024;
+
+template <int BITS>
+void advance_packed(const CompiledMachine &cm, PackedTape<BITS> &tape, RunResult &run, long long step_limit) {
+    typedef PackedTape<BITS> PT;
+    const uint32_t *tbl = cm.table;
+    const uint32_t n_syms = cm.n_symbols;
+    const long long head_bound = 1LL << 62;
+    uint32_t state = run.state;
+    long long steps = run.steps;
+    long long page_start = PT::page_start_of(run.head_pos);
+    long long offset = run.head_pos - page_start;
+    uint64_t *page = tape.page_at(page_start);
+    long long sweep_steps = 0;
+    Outcome outcome = OUT_RUNNING;
+    while (steps < step_limit) {
+        uint8_t symbol = PT::cell(page, offset);
+        uint32_t entry = tbl[state * n_syms + symbol];
+        uint8_t action = transition_action(entry);
+        if (action == ACT_NONE) {
+            outcome = OUT_NO_TRANSITION;
+            break;
+        }
+        // A sweep's entry is (state, symbol, L or R); anything else is below or past it
+        if (entry - ((state << 12) | (uint32_t(symbol) << 4)) <= ACT_R) {
+            if (++sweep_steps > SWEEP_THRESHOLD) {
+                long long pos = page_start + offset;
+                long long budget = min(step_limit - steps, head_bound - llabs(pos));
+                if (budget > 1) {
+                    int direction = (action == ACT_R) ? 1 : -1;
+                    long long stop = tape.find_other(pos, symbol, direction, budget);
+                    steps += (stop - pos) * direction;
+                    page_start = PT::page_start_of(stop);
+                    offset = stop - page_start;
+                    page = tape.page_at(page_start);
+                    sweep_steps = 0;
+                    continue;
+                }
+            }
+        } else {
+            sweep_steps = 0;
+        }
+        steps++;
+        uint8_t write_symbol = transition_write_symbol(entry);
+        if (write_symbol != symbol) {
+            if (tape.is_blank_page(page)) {
+                page = tape.materialize(page_start);
+            }
+            PT::set_cell(page, offset, write_symbol);
+        }
+        state = transition_next_state(entry);
+        if (action == ACT_R) {
+            if (++offset == PT::PAGE_SIZE) {
+                page_start += PT::PAGE_SIZE;
+                offset = 0;
+                page = tape.page_at(page_start);
+            }
+        } else if (action == ACT_L) {
+            if (offset-- == 0) {
+                page_start -= PT::PAGE_SIZE;
+                offset = PT::PAGE_SIZE - 1;
+                page = tape.page_at(page_start);
+            }
+        } else {
+            outcome = (action == ACT_Y) ? OUT_ACCEPT : OUT_REJECT;
+            break;
+        }
+    }
+    run = {outcome, steps, page_start + offset, state};
+}
+
+// One tape of each kind, reused from run to run; only the kinds a machine runs on allocate pages
+struct RunTapes {
+    Tape bytes;
+    PackedTape<1> bits1;
+    PackedTape<2> bits2;
+    PackedTape<4> bits4;
+
+    size_t page_count() const {
+        return this->bytes.page_count() + this->bits1.page_count() + this->bits2.page_count() + this->bits4.page_count();
+    }
+};
+
+// This function runs a compiled machine until it halts, honoring max_steps and time_limit, finishing on a packed tape
+template <int BITS>
+RunResult run_packed(const CompiledMachine &cm, const string &tape, Tape &bytes, PackedTape<BITS> &packed,
+                     long long head_pos, const RunOptions &options) {
+    RunResult run = cm.start(head_pos);
+    long long step_limit = (options.max_steps > 0) ? options.max_steps : LLONG_MAX;
+    long long stride = (options.time_limit > 0) ? options.check_stride : LLONG_MAX;
+    auto deadline = chrono::steady_clock::now() + chrono::duration<double>(options.time_limit);
+    auto running = [&]() {
+        return run.outcome == OUT_RUNNING && run.steps < step_limit &&
+               (options.time_limit <= 0 || chrono::steady_clock::now() < deadline);
+    };
+    if (options.tape_mode == TAPE_PACKED) {
+        if (!cm.encode_tape(tape, packed)) {
+            return {OUT_INVALID_TAPE, 0, head_pos, cm.initial_state};
+        }
+    } else {
+        // Start on bytes, which step faster, and move to packed cells once the tape outgrows PACKED_MIN_PAGES
+        if (!cm.encode_tape(tape, bytes)) {
+            return {OUT_INVALID_TAPE, 0, head_pos, cm.initial_state};
+        }
+        while (running() && bytes.page_count() <= PACKED_MIN_PAGES) {
+            cm.advance(bytes, run, min(step_limit, run.steps + options.check_stride));
+        }
+        if (!running()) {
+            if (run.outcome == OUT_RUNNING) {
+                run.outcome = OUT_TIMEOUT;
+            }
+            return run;
+        }
+        packed.reset(bytes.blank_symbol());
+        for (const TapeSegment &segment : bytes.segments()) {
+            for (size_t i = 0; i < segment.size; i++) {
+                packed.set(segment.start + i, segment.cells[i]);
+            }
+        }
+        bytes.reset();
+    }
+    while (running()) {
+        advance_packed(cm, packed, run, (stride == LLONG_MAX) ? step_limit : min(step_limit, run.steps + stride));
+    }
+    if (run.outcome == OUT_RUNNING) {
+        run.outcome = OUT_TIMEOUT;
+    }
+    return run;
+}
+
+bool runs_packed(const CompiledMachine &cm, const RunOptions &options) {
+    return options.tape_mode != TAPE_BYTES && cm.packed_bits() > 0 && options.engine == ENGINE_NAIVE &&
+           options.trace == TRACE_NONE && !options.detect_loops;
+}
+
+// This function encodes the tape and runs the machine on it, on the narrowest tape the machine and options allow
+RunResult run_on_tape(const CompiledMachine &cm, const string &tape, long long head_pos, RunTapes &tapes, const RunOptions &options) {
+    if (runs_packed(cm, options)) {
+        switch (cm.packed_bits()) {
+            case 1:
+                return run_packed(cm, tape, tapes.bytes, tapes.bits1, head_pos, options);
+            case 2:
+                return run_packed(cm, tape, tapes.bytes, tapes.bits2, head_pos, options);
+            default:
+                return run_packed(cm, tape, tapes.bytes, tapes.bits4, head_pos, options);
+        }
+    }
+    if (!cm.encode_tape(tape, tapes.bytes)) {
+        return {OUT_INVALID_TAPE, 0, head_pos, cm.initial_state};
+    }
+    return run_machine(cm, tapes.bytes, head_pos, options);
+}
+
+/*****************************************************************/
+/*********************** WORK-STEALING POOL **********************/
+/*****************************************************************/
+/* Runs body(worker, index) for every index in [0, n) on n_threads threads.
+
+    Each worker starts with a contiguous slice of the indices and takes them one at a
+    time from the front. A worker whose slice runs dry steals the back half of the
+    largest remaining slice, so a few very long tasks do not leave the other threads
+    idle. No tasks are created while running, so a worker that finds every slice empty
+    is done.
+*/
+struct WorkSlice {
+    mutex lock;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+void parallel_for(size_t n, int n_threads, const function<void(int, size_t)> &body) {
+    n_threads = max(1, (int)min<size_t>(n_threads, max<size_t>(n, 1)));
+    if (n_threads == 1) {
+        for (size_t i = 0; i < n; i++) {
+            body(0, i);
+        }
+        return;
+    }
+
+    vector<WorkSlice> slices(n_threads);
+    for (int w = 0; w < n_threads; w++) {
+        slices[w].begin = n * w / n_threads;
+        slices[w].end = n * (w + 1) / n_threads;
+    }
+
+    auto worker = [&](int w) {
+        WorkSlice &own = slices[w];
+        while (true) {
+            size_t index;
+            {
+                lock_guard<mutex> guard(own.lock);
+                index = (own.begin < own.end) ? own.begin++ : SIZE_MAX;
+            }
+            if (index != SIZE_MAX) {
+                body(w, index);
+                continue;
+            }
+
+            // Steal the back half of the victim with the most remaining work
+            int victim = -1;
+            size_t most = 0;
+            for (int v = 0; v < n_threads; v++) {
+                lock_guard<mutex> guard(slices[v].lock);
+                size_t remaining = slices[v].end - slices[v].begin;
+                if (v != w && remaining > most) {
+                    most = remaining;
+                    victim = v;
+                }
+            }
+            if (victim < 0) {
+                return;
+            }
+            size_t stolen_begin, stolen_end;
+            {
+                lock_guard<mutex> guard(slices[victim].lock);
+                WorkSlice &other = slices[victim];
+                if (other.begin >= other.end) {
+                    continue;
+                }
+                stolen_end = other.end;
+                stolen_begin = other.begin + (other.end - other.begin) / 2;
+                other.end = stolen_begin;
+            }
+            lock_guard<mutex> guard(own.lock);
+            own.begin = stolen_begin;
+            own.end = stolen_end;
+        }
+    };
+
+    vector<thread> threads;
+    for (int w = 1; w < n_threads; w++) {
+        threads.emplace_back(worker, w);
+    }
+    worker(0);
+    for (thread &t : threads) {
+        t.join();
+    }
+}
+
+int default_thread_count() {
+    return max(1, (int)thread::hardware_concurrency());
+}
+
+/*****************************************************************/
+/******************** NONDETERMINISTIC SEARCH ********************/
+/*****************************************************************/
+/* Explores the configurations of a nondeterministic machine breadth first.
+
+    A machine accepts if any branch reaches Y. Each level of the search expands every
+    configuration of the frontier on the work-stealing pool; a successor is kept only
+    if its (state, head, tape) has not been seen before, so branches that meet again
+    are explored once. The visited set is keyed by a 64-bit hash but keeps a copy of
+    every configuration, sharing its tape pages, and a hash match is confirmed cell
+    by cell, so a collision never prunes a configuration that was not visited.
+
+    Configurations hold CowTapes, so a successor shares every page of its parent but
+    the one it writes to, and the last successor of a configuration takes over its
+    parent's tape outright. The search stops at the first accepting branch, when
+    every branch has halted (reject), or when a bound is hit (timeout): the depth
+    bound (max_steps), the time limit, or the cap on live configurations.
+*/
+struct ChoiceMachine {
+    CompiledMachine cm;             // the table holds the first choice of each (state, symbol)
+    vector<uint32_t> offsets;       // the choices of table entry i are choices[offsets[i], offsets[i + 1])
+    vector<uint32_t> choices;
+};
+
+struct Configuration {
+    uint32_t state;
+    long long head_pos;
+    CowTape tape;
+};
+
+struct SearchResult {
+    Outcome outcome;
+    long long depth;            // steps of the accepting branch, or levels explored
+    long long head_pos;         // of the accepting branch
+    uint32_t state;
+    long long explored;         // configurations expanded
+    long long duplicates;       // successors dropped as already visited
+    size_t peak_live;           // most configurations alive at once (frontier and next level)
+    size_t peak_bytes;          // estimated peak memory of configurations, tape pages and the visited set
+};
+
+// Visited configurations by hash, sharded so workers rarely contend for a lock
+class VisitedSet {
+
+    private:
+        struct Shard {
+            mutex lock;
+            unordered_multimap<uint64_t, Configuration> configs;
+        };
+        array<Shard, 64> shards;
+        atomic<size_t> page_refs{0};
+
+    public:
+        // Adds config unless an equal configuration is already in the set; returns whether it was added
+        bool insert(uint64_t hash, const Configuration &config) {
+            Shard &shard = this->shards[hash >> 58];
+            lock_guard<mutex> guard(shard.lock);
+            auto range = shard.configs.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                const Configuration &seen = it->second;
+                if (seen.state == config.state && seen.head_pos == config.head_pos && seen.tape.same_cells(config.tape)) {
+                    return false;
+                }
+            }
+            shard.configs.emplace(hash, config);
+            this->page_refs += config.tape.page_count();
+            return true;
+        }
+
+        size_t size() {
+            size_t total = 0;
+            for (Shard &shard : this->shards) {
+                lock_guard<mutex> guard(shard.lock);
+                total += shard.configs.size();
+            }
+            return total;
+        }
+
+        // Page pointers held by the stored configurations
+        size_t page_count() const {
+            return this->page_refs;
+        }
+};
+
+class NondeterministicSearch {
+
+    private:
+        const ChoiceMachine &machine;
+        RunOptions options;
+        int n_threads;
+        size_t max_live;
+
+        static uint64_t configuration_hash(const Configuration &config) {
+            uint64_t x = (uint64_t(config.head_pos) << 20) ^ config.state;
+            x ^= x >> 33;
+            x *= 0xFF51AFD7ED558CCDULL;
+            x ^= x >> 33;
+            return x ^ config.tape.content_hash();
+        }
+
+    public:
+        NondeterministicSearch(const ChoiceMachine &machine, RunOptions options, int n_threads, size_t max_live)
+            : machine(machine), options(options), n_threads(max(1, n_threads)), max_live(max<size_t>(1, max_live)) {}
+
+        SearchResult run(const string &tape, long long head_pos) {
+            const CompiledMachine &cm = this->machine.cm;
+            CowStats stats;
+            VisitedSet visited;
+            SearchResult result = {OUT_TIMEOUT, 0, head_pos, cm.initial_state, 0, 0, 1, 0};
+
+            vector<Configuration> frontier;
+            frontier.push_back({cm.initial_state, head_pos, CowTape(cm.blank, &stats)});
+            for (size_t i = 0; i < tape.size(); i++) {
+                frontier.back().tape.set(i, uint8_t(cm.symbol_ids[(unsigned char)tape[i]]));
+            }
+            visited.insert(configuration_hash(frontier.back()), frontier.back());
+
+            const size_t page_bytes = sizeof(CowTape) + CowTape::PAGE_SIZE + 32;
+            auto start = chrono::steady_clock::now();
+            for (long long depth = 0; ; depth++) {
+                result.depth = depth;
+                if (frontier.empty()) {
+                    result.outcome = OUT_REJECT;
+                    break;
+                }
+                bool out_of_time = this->options.time_limit > 0 &&
+                    chrono::duration<double>(chrono::steady_clock::now() - start).count() >= this->options.time_limit;
+                if ((this->options.max_steps > 0 && depth >= this->options.max_steps) || out_of_time) {
+                    break;
+                }
+
+                vector<vector<Configuration>> next(this->n_threads);
+                atomic<bool> accepted{false}, overflow{false};
+                atomic<size_t> n_next{0}, page_refs{0};
+                atomic<long long> explored{0}, duplicates{0};
+                mutex accept_lock;
+                parallel_for(frontier.size(), this->n_threads, [&](int worker, size_t i) {
+                    if (accepted || overflow) {
+                        return;
+                    }
+                    explored++;
+                    Configuration &config = frontier[i];
+                    size_t entry = size_t(config.state) * cm.n_symbols + config.tape.get(config.head_pos);
+                    uint32_t first = this->machine.offsets[entry], last = this->machine.offsets[entry + 1];
+                    for (uint32_t k = first; k < last && !accepted; k++) {
+                        uint32_t choice = this->machine.choices[k];
+                        Configuration child = (k + 1 == last) ? move(config) : config;
+                        child.tape.set(child.head_pos, transition_write_symbol(choice));
+                        child.state = transition_next_state(choice);
+                        uint8_t action = transition_action(choice);
+                        if (action == ACT_L) {
+                            child.head_pos--;
+                        } else if (action == ACT_R) {
+                            child.head_pos++;
+                        } else if (action == ACT_Y) {
+                            lock_guard<mutex> guard(accept_lock);
+                            if (!accepted) {
+                                result.head_pos = child.head_pos;
+                                result.state = child.state;
+                                accepted = true;
+                            }
+                            return;
+                        } else {
+                            continue;
+                        }
+                        if (!visited.insert(configuration_hash(child), child)) {
+                            duplicates++;
+                            continue;
+                        }
+                        if (++n_next > this->max_live) {
+                            overflow = true;
+                            return;
+                        }
+                        page_refs += child.tape.page_count();
+                        next[worker].push_back(move(child));
+                    }
+                });
+
+                result.explored += explored;
+                result.duplicates += duplicates;
+                size_t live = frontier.size() + n_next;
+                size_t bytes = stats.live_pages * page_bytes + live * sizeof(Configuration) +
+                               (page_refs + visited.page_count()) * sizeof(pair<long long, shared_ptr<void>>) +
+                               visited.size() * (sizeof(Configuration) + 32);
+                result.peak_live = max(result.peak_live, live);
+                result.peak_bytes = max(result.peak_bytes, bytes);
+                if (accepted) {
+                    result.outcome = OUT_ACCEPT;
+                    result.depth = depth + 1;
+                    break;
+                }
+                if (overflow) {
+                    break;
+                }
+
+                frontier.clear();
+                for (vector<Configuration> &level : next) {
+                    move(level.begin(), level.end(), back_inserter(frontier));
+                }
+            }
+            return result;
+        }
+};
+
+/*****************************************************************/
+/************************ TURING MACHINE *************************/
+/*****************************************************************/
+class TuringMachine {
+
+    private:
+        /***************** Turing Machine specifications *****************/
+        set<string> states;
+        string initial_state;
+        set<char> input_symbols, tape_symbols;
+        map<tuple<string, char>, tuple<string, char, char>> transitions;
+        set<char> valid_actions = {'L', 'R', 'Y', 'N'};
+
+        // Further transitions of a nondeterministic machine for keys already in transitions, in file order
+        multimap<tuple<string, char>, tuple<string, char, char>> alternatives;
+        bool nondeterministic = false;
+
+        /***************** Functions to check validity of TM specs input *****************/
+        bool check_valid_state(string state) {
+            bool is_valid_string = (state.size() > 0);
+            bool is_not_duplicate = (this->states.find(state) == this->states.end());
+            return is_valid_string && is_not_duplicate;
+        }
+
+        bool check_valid_symbol(char symbol, set<char> symbol_set) {
+            bool is_not_duplicate = (symbol_set.find(symbol) == symbol_set.end());
+            return is_not_duplicate;
+        }
+
+        bool check_valid_tape_symbol_set() {
+            for (char input_symbol : input_symbols) {
+                if (this->tape_symbols.find(input_symbol) == this->tape_symbols.end()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool check_valid_transition(string transition) {
+            string temp_trans = "" + transition;
+            
+            size_t comma1 = temp_trans.find(',');
+            size_t comma2 = temp_trans.find(',', comma1 + 1);
+            size_t openParen = temp_trans.find('(');
+            size_t closeParen = temp_trans.find(')');
+
+            if (comma1 == string::npos || comma2 == string::npos || openParen == string::npos || closeParen == string::npos) {
+                return false;
+            }
+
+            string state = trim_copy(temp_trans.substr(openParen + 1, comma1 - openParen - 1));
+            char write_symbol = trim_copy(temp_trans.substr(comma1 + 1, comma2 - comma1 - 1))[0];
+            char action = toupper(trim_copy(temp_trans.substr(comma2 + 1, closeParen - comma2 - 1))[0]);
+
+            bool is_valid_action = (this->valid_actions.find(action) != this->valid_actions.end());
+            bool is_valid_write_symbol = (this->tape_symbols.find(write_symbol) != this->tape_symbols.end());
+            bool is_valid_state = (this->states.find(state) != this->states.end());
+
+            return is_valid_action && is_valid_write_symbol && is_valid_state;
+        }
+
+        uint32_t state_index(const string &state) {
+            return uint32_t(distance(this->states.begin(), this->states.find(state)));
+        }
+
+        // Parses a transition already accepted by check_valid_transition into (next_state, write_symbol, action)
+        tuple<string, char, char> parse_transition(string transition) {
+            size_t comma1 = transition.find(',');
+            size_t comma2 = transition.find(',', comma1 + 1);
+            size_t openParen = transition.find('(');
+            size_t closeParen = transition.find(')');
+
+            string next_state = trim_copy(transition.substr(openParen + 1, comma1 - openParen - 1));
+            char write_symbol = trim_copy(transition.substr(comma1 + 1, comma2 - comma1 - 1))[0];
+            char action = toupper(trim_copy(transition.substr(comma2 + 1, closeParen - comma2 - 1))[0]);
+            return make_tuple(next_state, write_symbol, action);
+        }
+
+
+    public:
+        /************************* Tape validation *************************/
+        bool check_valid_tape(string tape) {
+            for (int i = 0; i < tape.size(); i++) {
+                if (this->tape_symbols.find(tape[i]) == this->tape_symbols.end()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /************************* Getters *************************/
+        set<string> get_states() {
+            return states;
+        }
+
+        string get_initial_state() {
+            return initial_state;
+        }
+
+        set<char> get_input_symbols() {
+            return input_symbols;
+        }
+
+        set<char> get_tape_symbols() {
+            return tape_symbols;
+        }
+
+        map<tuple<string, char>, tuple<string, char, char>> get_transitions() {
+            return transitions;
+        }
+
+        /* This function compiles the Turing Machine into a dense transition table.
+
+            States are numbered in set order and tape symbols in set order. The blank '#'
+            and the left mark '<' are always interned, since they appear on every tape
+            even when they are not part of the tape alphabet. Missing transitions are
+            stored as ACT_NONE. Returns false, with an error on stderr, if the machine has
+            more states than a packed entry can number.
+        */
+        bool compile(CompiledMachine &cm) {
+            if (this->states.size() > MAX_STATES) {
+                cerr << red("Error: Too many states (at most " + to_string(MAX_STATES) + ")") << endl;
+                return false;
+            }
+            cm = CompiledMachine();
+            cm.symbol_ids.fill(-1);
+
+            map<string, uint32_t> state_ids;
+            for (const string &state : this->states) {
+                state_ids[state] = cm.n_states++;
+                cm.state_names.push_back(state);
+            }
+
+            set<char> alphabet = this->tape_symbols;
+            alphabet.insert('#');
+            alphabet.insert('<');
+            for (char symbol : alphabet) {
+                cm.symbol_ids[(unsigned char)symbol] = int16_t(cm.symbols.size());
+                cm.symbols.push_back(symbol);
+            }
+            cm.n_symbols = cm.symbols.size();
+            cm.blank = uint8_t(cm.symbol_ids[(unsigned char)'#']);
+            cm.left_mark = uint8_t(cm.symbol_ids[(unsigned char)'<']);
+            cm.initial_state = state_ids[this->initial_state];
+
+            cm.tape_alphabet = string(this->tape_symbols.begin(), this->tape_symbols.end());
+            cm.input_alphabet = string(this->input_symbols.begin(), this->input_symbols.end());
+
+            uint32_t *table = cm.allocate_table(pack_transition(0, 0, ACT_NONE));
+            for (auto transition : this->transitions) {
+                uint32_t state = state_ids[get<0>(transition.first)];
+                uint8_t tape_symbol = uint8_t(cm.symbol_ids[(unsigned char)get<1>(transition.first)]);
+                uint32_t next_state = state_ids[get<0>(transition.second)];
+                uint8_t write_symbol = uint8_t(cm.symbol_ids[(unsigned char)get<1>(transition.second)]);
+                uint8_t action = action_code(get<2>(transition.second));
+                table[size_t(state) * cm.n_symbols + tape_symbol] = pack_transition(next_state, write_symbol, action);
+            }
+            return true;
+        }
+
+        // Lets the next definition loaded give several transitions for the same (state, symbol)
+        void allow_nondeterminism() {
+            this->nondeterministic = true;
+        }
+
+        bool has_alternatives() {
+            return !this->alternatives.empty();
+        }
+
+        /* This function compiles every transition of a nondeterministic machine.
+
+            The CompiledMachine is the one compile() builds, holding the first transition of
+            each (state, symbol); the choices list all of them, first transition first.
+        */
+        bool compile_choices(ChoiceMachine &machine) {
+            if (!compile(machine.cm)) {
+                return false;
+            }
+            const CompiledMachine &cm = machine.cm;
+            size_t n_entries = size_t(cm.n_states) * cm.n_symbols;
+            machine.offsets.assign(n_entries + 1, 0);
+            for (size_t entry = 0; entry < n_entries; entry++) {
+                machine.offsets[entry] = machine.choices.size();
+                if (transition_action(cm.table[entry]) == ACT_NONE) {
+                    continue;
+                }
+                machine.choices.push_back(cm.table[entry]);
+                string state = cm.state_names[entry / cm.n_symbols];
+                char symbol = cm.symbols[entry % cm.n_symbols];
+                auto range = this->alternatives.equal_range(make_tuple(state, symbol));
+                for (auto it = range.first; it != range.second; ++it) {
+                    machine.choices.push_back(pack_transition(state_index(get<0>(it->second)),
+                                                              uint8_t(cm.symbol_ids[(unsigned char)get<1>(it->second)]),
+                                                              action_code(get<2>(it->second))));
+                }
+            }
+            machine.offsets[n_entries] = machine.choices.size();
+            return true;
+        }
+
+        // This function takes Turing Machine specifications as input from the user
+        void get_TM_specs_from_user() {
+            // Read states
+            int n_states = take_valid_int_input(bold("Enter number of states: "), 1, MAX_STATES);
+            for (int i = 0; i < n_states; i++) {
+                string prompt = "Enter state " + to_string(i + 1) + "/" + to_string(n_states) + ": ";
+                string state = take_valid_string_input(prompt);
+                if (check_valid_state(state)) {
+                    this->states.insert(state);
+                } else {
+                    cout << red("Error: Invalid state.") << endl;
+                    i--;
+                }
+            }
+            
+            // Read input symbols
+            cout << "==================================\n";
+            int n_ipsymbols = take_valid_int_input(bold("Enter number of input symbols: "));
+            for (int i = 0; i < n_ipsymbols; i++) {
+                char input_symbol = take_valid_char_input("Enter input symbol " + to_string(i + 1) + "/" + to_string(n_ipsymbols) + ": ");
+                if (check_valid_symbol(input_symbol, input_symbols)) {
+                    input_symbols.insert(input_symbol);
+                } else {
+                    cout << red("Error: Invalid input symbol.") << endl;
+                    i--;
+                }
+            }
+            
+            // Read tape symbols
+            cout << "==================================\n" << cyan("Note: Tape symbols must include input symbols.") << endl;
+            int n_tsymbols = take_valid_int_input(bold("Enter number of tape symbols: "), n_ipsymbols, INT_MAX);
+            while(true) {
+                for (int i = 0; i < n_tsymbols; i++) {
+                    char tape_symbol = take_valid_char_input("Enter tape symbol " + to_string(i + 1) + "/" + to_string(n_tsymbols) + ": ");
+                    if (check_valid_symbol(tape_symbol, this->tape_symbols)) {
+                        this->tape_symbols.insert(tape_symbol);
+                    } else {
+                        cout << red("Error: Invalid tape symbol.") << endl;
+                        i--;
+                    }
+                }
+                if (check_valid_tape_symbol_set())
+                    break;
+                cout << red("Error: Input symbols must be a subset of tape symbols.") << endl;
+                this->tape_symbols.clear();
+            }
+            
+            char left_mark;
+            while(true) {
+                left_mark = take_valid_char_input("Add transition for left mark \'<\'? (y/n): ");
+                if (left_mark == 'y') {
+                    this->tape_symbols.insert('<');
+                    n_tsymbols++;
+                    break;
+                } else if (left_mark == 'n') {
+                    break;
+                }
+                cout << red("Error: Invalid input.") << endl;
+            }
+
+            // Read initial state
+            cout << "==================================\n";
+            while(true) {
+                initial_state = take_valid_string_input(bold("Enter initial state: "));
+                if (this->states.find(initial_state) != this->states.end()) {
+                    break;
+                }
+                cout << red("Error: Unrecognized state.") << endl;
+            }
+            
+            
+            // Read transitions
+            cout << "==================================\n" << cyan("Note: Transitions must be in the format (state,tapeSymbol) -> (nextState,writeSymbol,move) without spaces") << endl;
+            int n_transitions = n_states * n_tsymbols;
+            vector<char> tape_symbols_vec(this->tape_symbols.begin(), this->tape_symbols.end());
+            cout << bold(underline("State transitions:")) << endl;
+            for (string state : this->states) {
+                for (int i = 0; i < n_tsymbols; i++) {
+                    char tape_symbol = tape_symbols_vec[i];
+                    string prompt = "(" + state + "," + tape_symbol + ") -> ";
+                    string transition = take_valid_string_input(prompt);
+                    if (check_valid_transition(transition)) {
+                        transitions[make_tuple(state, tape_symbol)] = parse_transition(transition);
+                    } else {
+                        cout << red("Error: Invalid transition.") << endl;
+                        i--;
+                    }
+                }
+            }
+        }
+
+        /* This function loads Turing Machine specifications from a definition file
+
+            Definition file format (blank lines and lines starting with '#' are ignored):
+            states: q0 q1
+            input: 0 1
+            tape: 0 1 # <
+            initial: q0
+            (q0,0) -> (q0,0,R)
+            (q0,#) -> (q1,#,L)
+            ...
+
+            The left mark '<' is included in the tape symbols by listing it on the tape line.
+            Transitions may be sparse; a missing transition stops the machine with an error.
+            A nondeterministic machine (see allow_nondeterminism) may list several transitions
+            for the same (state, symbol). Errors are reported to stderr with their line number.
+        */
+        bool load_TM_specs_from_file(string path) {
+            ifstream file(path);
+            if (!file) {
+                cerr << red("Error: Cannot open machine definition " + path) << endl;
+                return false;
+            }
+            return load_TM_specs(file, path);
+        }
+
+        // Same as load_TM_specs_from_file, for definitions built in memory; source names the definition in errors
+        bool load_TM_specs(istream &file, string source) {
+            bool ok = true;
+            auto report = [&](int line_no, string message) {
+                cerr << red("Error: " + source + ":" + to_string(line_no) + ": " + message) << endl;
+                ok = false;
+            };
+
+            string line;
+            int line_no = 0;
+            while (getline(file, line)) {
+                line_no++;
+                trim(line);
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+
+                if (line[0] == '(') {
+                    size_t arrow = line.find("->");
+                    size_t comma = line.find(',');
+                    size_t closeParen = line.find(')');
+                    if (arrow == string::npos || comma == string::npos || closeParen == string::npos || comma > closeParen) {
+                        report(line_no, "Invalid transition.");
+                        continue;
+                    }
+                    string state = trim_copy(line.substr(1, comma - 1));
+                    string symbol = trim_copy(line.substr(comma + 1, closeParen - comma - 1));
+                    string transition = trim_copy(line.substr(arrow + 2));
+                    if (this->states.find(state) == this->states.end()) {
+                        report(line_no, "Unrecognized state " + state + ".");
+                    } else if (symbol.size() != 1 || this->tape_symbols.find(symbol[0]) == this->tape_symbols.end()) {
+                        report(line_no, "Unrecognized tape symbol " + symbol + ".");
+                    } else if (!check_valid_transition(transition)) {
+                        report(line_no, "Invalid transition.");
+                    } else if (!this->transitions.emplace(make_tuple(state, symbol[0]), parse_transition(transition)).second) {
+                        if (this->nondeterministic) {
+                            this->alternatives.emplace(make_tuple(state, symbol[0]), parse_transition(transition));
+                        } else {
+                            report(line_no, "Duplicate transition for (" + state + "," + symbol + ").");
+                        }
+                    }
+                    continue;
+                }
+
+                size_t colon = line.find(':');
+                if (colon == string::npos) {
+                    report(line_no, "Expected 'key: values' or a transition.");
+                    continue;
+                }
+                string key = trim_copy(line.substr(0, colon));
+                istringstream values(line.substr(colon + 1));
+                string value;
+                if (key == "states") {
+                    while (values >> value) {
+                        if (!check_valid_state(value)) {
+                            report(line_no, "Invalid state " + value + ".");
+                        }
+                        this->states.insert(value);
+                    }
+                } else if (key == "input" || key == "tape") {
+                    set<char> &symbol_set = (key == "input") ? this->input_symbols : this->tape_symbols;
+                    while (values >> value) {
+                        if (value.size() != 1 || !check_valid_symbol(value[0], symbol_set)) {
+                            report(line_no, "Invalid symbol " + value + ".");
+                        }
+                        symbol_set.insert(value[0]);
+                    }
+                } else if (key == "initial") {
+                    values >> this->initial_state;
+                    if (this->states.find(this->initial_state) == this->states.end()) {
+                        report(line_no, "Unrecognized initial state " + this->initial_state + ".");
+                    }
+                } else {
+                    report(line_no, "Unknown key " + key + ".");
+                }
+            }
+
+            if (this->states.empty()) {
+                report(line_no, "No states defined.");
+            } else if (this->states.size() > MAX_STATES) {
+                report(line_no, "Too many states (at most " + to_string(MAX_STATES) + ").");
+            }
+            if (this->initial_state.empty()) {
+                report(line_no, "No initial state defined.");
+            }
+            if (!check_valid_tape_symbol_set()) {
+                report(line_no, "Input symbols must be a subset of tape symbols.");
+            }
+            return ok;
+        }
+
+        // This function prints the Turing Machine specifications to the console
+        void print_TM_specs() {
+            cout << "==================================\n";
+            cout << bold(underline("Turing Machine specifications:")) << endl;
+            // cout << bold("M = (K, Σ, Γ, δ, S)") << endl;
+            // cout << bold("K = {");
+            cout << bold("States = {");
+            if (!this->states.empty()) {
+                auto it = this->states.begin();
+                cout << *it;
+                ++it;
+                for (; it != this->states.end(); ++it) {
+                    cout << ", " << *it;
+                }
+            }
+            cout << "}" << endl;
+
+            // cout << bold("Σ = {");
+            cout << bold("Input symbols = {");
+            if (!this->input_symbols.empty()) {
+                auto it = this->input_symbols.begin();
+                cout << *it;
+                ++it;
+                for (; it != this->input_symbols.end(); ++it) {
+                    cout << ", " << *it;
+                }
+            }
+            cout << "}" << endl;
+
+            // cout << bold("Γ = {");
+            cout << bold("Tape symbols = {");
+            if (!this->tape_symbols.empty()) {
+                auto it = this->tape_symbols.begin();
+                cout << *it;
+                ++it;
+                for (; it != this->tape_symbols.end(); ++it) {
+                    cout << ", " << *it;
+                }
+            }
+            cout << "}" << endl;
+
+            // cout << bold("S = ") << this->initial_state << endl;
+            cout << bold("Initial state = ") << this->initial_state << endl;
+
+            // cout << bold("δ = (") << endl;
+            cout << bold("Transitions = (") << endl;
+            for (auto transition : this->transitions) {
+                string state = get<0>(transition.first);
+                char tape_symbol = get<1>(transition.first);
+                string next_state = get<0>(transition.second);
+                char write_symbol = get<1>(transition.second);
+                char action = get<2>(transition.second);
+
+                cout << "(" << state << "," << tape_symbol << ") , (" << next_state << "," << write_symbol << "," << action << ")" << endl;
+            }
+            cout << ")" << endl << endl;
+        }
+
+        // This function takes input tape and head position from the user
+        pair<string, int> get_input_tape() {
+            cout << cyan("Note: Enter tape without spaces.") << endl;
+            string tape;
+            while (true) {
+                tape = take_valid_string_input(bold("Tape: ") + "<");
+                if (check_valid_tape(tape)) {
+                    break;
+                }
+                cout << red("Error: Invalid tape.") << endl;
+            }
+
+            cout << cyan("Note: Left mark is at position 0. Your string probably starts at position 1") << endl;
+            int head_pos = take_valid_int_input(bold("Enter initial head position: "), 0);
+            return make_input_tape(tape, head_pos);
+        }
+
+        // This function prepends the left mark; cells beyond the input are blank on the unbounded tape
+        pair<string, int> make_input_tape(string tape, int head_pos) {
+            return make_pair("<" + tape, head_pos);
+        }
+
+        // This function prints the tape with the head position
+        void print_tape(string tape, int head_pos) {
+            for (int i = 0; i < tape.size(); i++) {
+                if (i == head_pos) {
+                    cout << bold(underline(string(1, tape[i])));
+                } else {
+                    cout << tape[i];
+                }
+            }
+            cout << "####...";
+        }
+
+        // This function runs the Turing Machine on the input tape, traces the steps and prints the final tape
+        void run_TM(string tape, int head_pos, RunOptions options = RunOptions{TRACE_FULL}) {
+            CompiledMachine cm;
+            if (!compile(cm)) {
+                return;
+            }
+            Tape cells;
+            cm.encode_tape(tape, cells);
+            cout << "==================================\n";
+            cout << bold("Running Turing Machine...") << endl;
+
+            TraceWriter writer;
+            RunResult result = run_machine(cm, cells, head_pos, options, &writer);
+            if (result.outcome == OUT_ACCEPT) {
+                cout << green("Accepted.") << endl;
+            } else if (result.outcome == OUT_REJECT) {
+                cout << red("Rejected.") << endl;
+            } else if (result.outcome == OUT_NO_TRANSITION) {
+                cout << red("Error: No transition found for state " + cm.state_names[result.state] + " and symbol " + cm.symbols[cells.get(result.head_pos)]) << endl;
+            } else if (result.outcome == OUT_TIMEOUT) {
+                cout << red("Stopped: step or time limit reached.") << endl;
+            } else if (result.outcome == OUT_LOOP) {
+                cout << red("Stopped: the machine never halts (loop detected).") << endl;
+            }
+            cout << bold("Steps: ") << result.steps << endl;
+
+            // Print from the leftmost written cell (or the left mark) to the rightmost written cell or the head
+            pair<long long, long long> written = cells.nonblank_range();
+            long long from = min(0LL, result.head_pos), to = max((long long)tape.size() - 1, result.head_pos);
+            if (written.first <= written.second) {
+                from = min(from, written.first);
+                to = max(to, written.second);
+            }
+            cout << "==================================\n";
+            cout << bold("Final tape: ") << endl;
+            if (from < 0) {
+                cout << "...####";
+            }
+            print_tape(cm.decode_tape(cells, from, to + 1), result.head_pos - from);
+            cout << endl;
+        }
+
+        // This function runs the Turing Machine silently on the transitions map (the uncompiled reference path)
+        RunResult run_reference(string tape, long long head_pos) {
+            string state = this->initial_state;
+            long long steps = 0;
+            long long origin = 0;       // index in tape of cell 0, grows as the tape extends to the left
+            long long index = head_pos;
+            while (true) {
+                auto it = this->transitions.find(make_tuple(state, tape[index]));
+                if (it == this->transitions.end()) {
+                    return {OUT_NO_TRANSITION, steps, index - origin, state_index(state)};
+                }
+                steps++;
+                tape[index] = get<1>(it->second);
+                state = get<0>(it->second);
+                char action = get<2>(it->second);
+                if (action == 'L') {
+                    if (--index < 0) {
+                        tape.insert(tape.begin(), '#');
+                        index = 0;
+                        origin++;
+                    }
+                } else if (action == 'R') {
+                    if (++index == (long long)tape.size()) {
+                        tape.push_back('#');
+                    }
+                } else {
+                    return {action == 'Y' ? OUT_ACCEPT : OUT_REJECT, steps, index - origin, state_index(state)};
+                }
+            }
+        }
+
+        // This function measures steps/second of the reference and compiled engines on the same input tape
+        void compare_engines(string tape, int head_pos) {
+            CompiledMachine cm;
+            if (!compile(cm)) {
+                return;
+            }
+            Tape cells;
+
+            const double min_seconds = 0.5;
+            auto measure = [&](auto run_once) {
+                long long total_steps = 0;
+                auto start = chrono::steady_clock::now();
+                double elapsed = 0;
+                do {
+                    total_steps += run_once();
+                    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                } while (elapsed < min_seconds);
+                return total_steps / elapsed;
+            };
+
+            double reference_rate = measure([&]() { return run_reference(tape, head_pos).steps + 1; });
+            double compiled_rate = measure([&]() {
+                cm.encode_tape(tape, cells);
+                return cm.run(cells, head_pos).steps + 1;
+            });
+
+            cout << "==================================\n";
+            cout << bold(underline("Engine comparison:")) << endl;
+            cout << bold("Reference (map) engine: ") << (long long)reference_rate << " steps/s" << endl;
+            cout << bold("Compiled (table) engine: ") << (long long)compiled_rate << " steps/s" << endl;
+            cout << bold("Speedup: ") << compiled_rate / reference_rate << "x" << endl;
+        }
+
+        /* This function translates the Turing Machine to machine code
+        
+            Machine code format:
+            <state><tape_symbol><next_state><write_symbol><action>00<state><tape_symbol><next_state><write_symbol><action>00...
+
+            The machine code is generated using unary encoding.
+            Example:
+            States: {q0, q1, q2} ==> Unary encoding: {1, 11, 111}
+            Tape symbols: {#, 0, 1} ==> Unary encoding: {1, 11, 111}
+            Actions: {L, R, Y, N} ==> Unary encoding: {1, 11, 111, 1111}
+            Transition: (q0, 0) -> (q2, 1, R) ==> Unary encoding: 101101110111011
+        */
+        string get_machine_code() {
+            // Index maps so each field is encoded in O(1) instead of a linear walk of the sets
+            unordered_map<string, size_t> state_index;
+            for (const string &state : this->states) {
+                state_index.emplace(state, state_index.size());
+            }
+            array<size_t, 256> symbol_index;
+            size_t n_symbols = 0;
+            for (char symbol : this->tape_symbols) {
+                symbol_index[(unsigned char)symbol] = n_symbols++;
+            }
+            const char *action_codes[] = {"1", "11", "111", "1111"};
+
+            string machine_code;
+            auto it = this->transitions.begin();
+            while (it != this->transitions.end()) {
+                auto transition = *it;
+                machine_code.append(state_index[get<0>(transition.first)] + 1, '1');
+                machine_code += '0';
+                machine_code.append(symbol_index[(unsigned char)get<1>(transition.first)] + 1, '1');
+                machine_code += '0';
+                machine_code.append(state_index[get<0>(transition.second)] + 1, '1');
+                machine_code += '0';
+                machine_code.append(symbol_index[(unsigned char)get<1>(transition.second)] + 1, '1');
+                machine_code += '0';
+                machine_code += action_codes[action_code(get<2>(transition.second))];
+
+                it++;
+                if (it != this->transitions.end()) {
+                    machine_code += "00";
+                }
+            }
+            return machine_code;
+        }
+
+        void translate_TM_to_machine_code() {
+            cout << bold("Encoded TM string (machine code):") << endl << get_machine_code() << endl;
+            cout << "==================================\n";
+        }
+
+};
+
+/*****************************************************************/
+/************************ CODE GENERATION ************************/
+/*****************************************************************/
+/* Emits a standalone C++ program with the transition function compiled in.
+
+    Every state becomes a label and every (state, symbol) transition a case of a switch
+    that writes (only when the symbol changes), moves and jumps straight to the label of
+    the next state, so no table lookup or action dispatch is left at run time. The
+    program uses the same paged Tape from tape.h and reads tapes and prints result lines
+    in the same format as batch mode, so its output can be diffed against the
+    interpreter's. With --stats it reports steps/second on stderr like batch mode does.
+
+    Build it next to tape.h:  g++ -std=c++17 -O2 -I<repo> -o machine machine.cpp
+*/
+void emit_cpp(const CompiledMachine &cm, ostream &out) {
+    out << "// Generated by turing --emit-cpp. Do not edit.\n";
+    out << "#include <chrono>\n#include <climits>\n#include <cstdlib>\n#include <cstring>\n#include <iostream>\n#include <sstream>\n#include <string>\n\n";
+    out << "#include \"tape.h\"\n\n";
+    out << "using namespace std;\n\n";
+
+    out << "// Tape character -> symbol ID, -1 if outside the alphabet\n";
+    out << "static int symbol_id(char c) {\n    switch ((unsigned char)c) {\n";
+    for (uint32_t id = 0; id < cm.n_symbols; id++) {
+        out << "        case " << int((unsigned char)cm.symbols[id]) << ": return " << id << ";\n";
+    }
+    out << "    }\n    return -1;\n}\n\n";
+
+    out << "// Characters accepted in input tapes (the tape alphabet)\n";
+    out << "static bool is_tape_symbol(char c) {\n    switch ((unsigned char)c) {\n";
+    for (char symbol : cm.tape_alphabet) {
+        out << "        case " << int((unsigned char)symbol) << ":\n";
+    }
+    out << "            return true;\n    }\n    return false;\n}\n\n";
+
+    out << "struct Result {\n    const char *outcome;\n    long long steps;\n    long long head_pos;\n};\n\n";
+
+    out << "#define MOVE_R if (++offset == Tape::PAGE_SIZE) { page_start += Tape::PAGE_SIZE; offset = 0; page = tape.page_at(page_start); }\n";
+    out << "#define MOVE_L if (offset-- == 0) { page_start -= Tape::PAGE_SIZE; offset = Tape::PAGE_SIZE - 1; page = tape.page_at(page_start); }\n";
+    out << "#define WRITE(symbol) { if (tape.is_blank_page(page)) page = tape.materialize(page_start); page[offset] = (symbol); }\n\n";
+
+    out << "static Result run(Tape &tape, long long head_pos, long long max_steps) {\n";
+    out << "    long long page_start = Tape::page_start_of(head_pos);\n";
+    out << "    long long offset = head_pos - page_start;\n";
+    out << "    uint8_t *page = tape.page_at(page_start);\n";
+    out << "    long long steps = 0;\n";
+    out << "    goto S" << cm.initial_state << ";\n";
+    for (uint32_t state = 0; state < cm.n_states; state++) {
+        out << "\nS" << state << ": // " << cm.state_names[state] << "\n";
+        out << "    if (steps == max_steps) return {\"timeout\", steps, page_start + offset};\n";
+        out << "    switch (page[offset]) {\n";
+        for (uint32_t symbol = 0; symbol < cm.n_symbols; symbol++) {
+            uint32_t entry = cm.table[size_t(state) * cm.n_symbols + symbol];
+            uint8_t action = transition_action(entry);
+            if (action == ACT_NONE) {
+                continue;
+            }
+            uint8_t write_symbol = transition_write_symbol(entry);
+            out << "        case " << symbol << ": steps++; ";
+            if (write_symbol != symbol) {
+                out << "WRITE(" << int(write_symbol) << "); ";
+            }
+            if (action == ACT_L || action == ACT_R) {
+                out << (action == ACT_L ? "MOVE_L; " : "MOVE_R; ") << "goto S" << transition_next_state(entry) << ";\n";
+            } else {
+                out << "return {\"" << (action == ACT_Y ? "accept" : "reject") << "\", steps, page_start + offset};\n";
+            }
+        }
+        out << "        default: return {\"error\", steps, page_start + offset};\n";
+        out << "    }\n";
+    }
+    out << "}\n\n";
+
+    out << "int main(int argc, char *argv[]) {\n";
+    out << "    long long max_steps = LLONG_MAX;\n";
+    out << "    bool stats = false;\n";
+    out << "    for (int i = 1; i < argc; i++) {\n";
+    out << "        if (strcmp(argv[i], \"--max-steps\") == 0 && i + 1 < argc) {\n";
+    out << "            max_steps = atoll(argv[++i]);\n";
+    out << "            if (max_steps <= 0) max_steps = LLONG_MAX;\n";
+    out << "        } else if (strcmp(argv[i], \"--stats\") == 0) {\n";
+    out << "            stats = true;\n";
+    out << "        }\n";
+    out << "    }\n\n";
+    out << "    Tape tape(" << int(cm.blank) << ");\n";
+    out << "    string line, input;\n";
+    out << "    long long n_tapes = 0, total_steps = 0;\n";
+    out << "    auto start = chrono::steady_clock::now();\n";
+    out << "    while (getline(cin, line)) {\n";
+    out << "        istringstream fields(line);\n";
+    out << "        int head_pos = 1;\n";
+    out << "        input.clear();\n";
+    out << "        fields >> input >> head_pos;\n";
+    out << "        bool valid = head_pos >= 0;\n";
+    out << "        for (char c : input) {\n";
+    out << "            valid = valid && is_tape_symbol(c);\n";
+    out << "        }\n";
+    out << "        n_tapes++;\n";
+    out << "        if (!valid) {\n";
+    out << "            cout << input << '\\t' << \"invalid\" << '\\t' << 0 << '\\t' << head_pos << '\\n';\n";
+    out << "            continue;\n";
+    out << "        }\n";
+    out << "        tape.reset();\n";
+    out << "        tape.set(0, symbol_id('<'));\n";
+    out << "        for (size_t i = 0; i < input.size(); i++) {\n";
+    out << "            tape.set(i + 1, symbol_id(input[i]));\n";
+    out << "        }\n";
+    out << "        Result result = run(tape, head_pos, max_steps);\n";
+    out << "        total_steps += result.steps;\n";
+    out << "        cout << input << '\\t' << result.outcome << '\\t' << result.steps << '\\t' << result.head_pos << '\\n';\n";
+    out << "    }\n";
+    out << "    cout.flush();\n";
+    out << "    if (stats) {\n";
+    out << "        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();\n";
+    out << "        cerr << n_tapes << \" tapes, \" << total_steps << \" steps, \" << seconds << \" s, \" << (long long)(total_steps / seconds) << \" steps/s\" << endl;\n";
+    out << "    }\n";
+    out << "    return 0;\n";
+    out << "}\n";
+}
+
+/*****************************************************************/
+/************************** BATCH MODE ***************************/
+/*****************************************************************/
+/* Runs a compiled machine over many input tapes in parallel.
+
+    The compiled machine is shared read-only between the workers; each worker keeps its
+    own Tape, whose pages are reused from one input to the next. Results are returned
+    in input order.
+*/
+struct TapeJob {
+    string tape;            // including the left mark
+    long long head_pos;
+    bool valid;
+};
+
+class BatchRunner {
+
+    private:
+        const CompiledMachine &cm;
+        RunOptions options;
+        int n_threads;
+        vector<RunTapes> worker_tapes;
+
+    public:
+        BatchRunner(const CompiledMachine &cm, RunOptions options, int n_threads)
+            : cm(cm), options(options), n_threads(max(1, n_threads)), worker_tapes(max(1, n_threads)) {
+            this->options.trace = TRACE_NONE;
+        }
+
+        vector<RunResult> run(const vector<TapeJob> &jobs) {
+            vector<RunResult> results(jobs.size());
+            parallel_for(jobs.size(), this->n_threads, [&](int worker, size_t i) {
+                const TapeJob &job = jobs[i];
+                if (!job.valid) {
+                    results[i] = {OUT_INVALID_TAPE, 0, job.head_pos, this->cm.initial_state};
+                    return;
+                }
+                results[i] = run_on_tape(this->cm, job.tape, job.head_pos, this->worker_tapes[worker], this->options);
+            });
+            return results;
+        }
+};
+
+/* Runs a loaded machine over many input tapes without any prompts.
+
+    Each input line holds a tape without the left mark, optionally followed by the
+    initial head position (default 1, the first cell after the left mark):
+    1011
+    1011 4
+
+    One result line is printed per tape: <tape> <outcome> <steps> <final head position>
+    Tapes are read in blocks and each block is run on n_threads threads. Tracing
+    runs single-threaded so the trace lines of a tape stay together.
+*/
+bool read_tape_job(const CompiledMachine &cm, const string &line, string &tape, TapeJob &job) {
+    istringstream fields(line);
+    int head_pos = 1;
+    tape.clear();
+    fields >> tape >> head_pos;
+    job.valid = cm.check_valid_input(tape) && head_pos >= 0;
+    job.tape = "<" + tape;
+    job.head_pos = head_pos;
+    return job.valid;
+}
+
+void run_batch(const CompiledMachine &cm, istream &in, ostream &out, const RunOptions &options, int n_threads, bool stats = false) {
+    string line;
+    long long n_tapes = 0, total_steps = 0;
+    auto start = chrono::steady_clock::now();
+    auto report_stats = [&]() {
+        if (stats) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cerr << n_tapes << " tapes, " << total_steps << " steps, " << seconds << " s, " << (long long)(total_steps / seconds) << " steps/s" << endl;
+        }
+    };
+
+    if (options.trace != TRACE_NONE) {
+        TraceWriter writer;
+        Tape cells;
+        string tape;
+        TapeJob job;
+        while (getline(in, line)) {
+            RunResult result = {OUT_INVALID_TAPE, 0, 0, cm.initial_state};
+            if (read_tape_job(cm, line, tape, job)) {
+                cm.encode_tape(job.tape, cells);
+                result = run_machine(cm, cells, job.head_pos, options, &writer);
+            } else {
+                result.head_pos = job.head_pos;
+            }
+            n_tapes++;
+            total_steps += result.steps;
+            out << tape << '\t' << outcome_name(result.outcome) << '\t' << result.steps << '\t' << result.head_pos << '\n';
+        }
+        out.flush();
+        report_stats();
+        return;
+    }
+
+    const size_t block_size = 1 << 16;
+    BatchRunner runner(cm, options, n_threads);
+    vector<string> tapes;
+    vector<TapeJob> jobs;
+    bool more = true;
+    while (more) {
+        tapes.clear();
+        jobs.clear();
+        while (jobs.size() < block_size && (more = bool(getline(in, line)))) {
+            tapes.emplace_back();
+            jobs.emplace_back();
+            read_tape_job(cm, line, tapes.back(), jobs.back());
+        }
+        vector<RunResult> results = runner.run(jobs);
+        for (size_t i = 0; i < results.size(); i++) {
+            n_tapes++;
+            total_steps += results[i].steps;
+            out << tapes[i] << '\t' << outcome_name(results[i].outcome) << '\t' << results[i].steps << '\t' << results[i].head_pos << '\n';
+        }
+    }
+    out.flush();
+    report_stats();
+}
+
+// This function reports batch throughput at 1, 2, 4, 8 and all hardware threads
+void benchmark_scaling(const CompiledMachine &cm, istream &in) {
+    vector<TapeJob> jobs;
+    string line, tape;
+    while (getline(in, line)) {
+        jobs.emplace_back();
+        read_tape_job(cm, line, tape, jobs.back());
+    }
+
+    set<int> thread_counts = {1, 2, 4, 8, default_thread_count()};
+    double base_seconds = 0;
+    cout << bold(underline("Batch scaling:")) << " " << jobs.size() << " tapes, " << default_thread_count() << " hardware threads" << endl;
+    for (int n_threads : thread_counts) {
+        BatchRunner runner(cm, RunOptions(), n_threads);
+        auto start = chrono::steady_clock::now();
+        vector<RunResult> results = runner.run(jobs);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long long steps = 0;
+        for (const RunResult &result : results) {
+            steps += result.steps;
+        }
+        if (n_threads == 1) {
+            base_seconds = seconds;
+        }
+        cout << bold(to_string(n_threads) + " threads: ") << seconds << " s, "
+             << (long long)(jobs.size() / seconds) << " tapes/s, "
+             << (long long)(steps / seconds) << " steps/s, speedup " << base_seconds / seconds << "x" << endl;
+    }
+}
+
+/* Runs each input tape through the nondeterministic search.
+
+    Tapes are read like batch mode, and each search runs on n_threads threads. One
+    result line is printed per tape:
+    <tape> <outcome> <depth> <head> <explored> <duplicates> <peak live configurations> <peak bytes>
+*/
+void run_nondeterministic(const ChoiceMachine &machine, istream &in, ostream &out, const RunOptions &options,
+                          int n_threads, size_t max_live, bool stats = false) {
+    NondeterministicSearch search(machine, options, n_threads, max_live);
+    string line, tape;
+    TapeJob job;
+    long long n_tapes = 0, explored = 0;
+    auto start = chrono::steady_clock::now();
+    while (getline(in, line)) {
+        n_tapes++;
+        if (!read_tape_job(machine.cm, line, tape, job)) {
+            out << tape << '\t' << outcome_name(OUT_INVALID_TAPE) << '\n';
+            continue;
+        }
+        SearchResult result = search.run(job.tape, job.head_pos);
+        explored += result.explored;
+        out << tape << '\t' << outcome_name(result.outcome) << '\t' << result.depth << '\t' << result.head_pos << '\t'
+            << result.explored << '\t' << result.duplicates << '\t' << result.peak_live << '\t' << result.peak_bytes << '\n';
+    }
+    out.flush();
+    if (stats) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << n_tapes << " tapes, " << explored << " configurations, " << seconds << " s, "
+             << (long long)(explored / seconds) << " configurations/s" << endl;
+    }
+}
+
+/*****************************************************************/
+/*************************** PROFILER ****************************/
+/*****************************************************************/
+/* Profiles runs of a machine: where the steps go.
+
+    The profiled loop is the naive loop plus one counter increment per step, in a table
+    with one counter per (state, symbol) entry; per-state counts are the row sums. It also
+    tracks the current run of self-looping steps (the state does not change), which costs
+    a comparison, and keeps the longest runs: long ones are sweeps across the tape.
+
+    The loop runs in chunks of sample_every steps. Between chunks the head position is
+    added to the heatmap and the tape size to the growth timeline, so both are sampled
+    rather than exact. The timeline keeps at most MAX_GROWTH_SAMPLES points; when it is
+    full every other point is dropped and the interval between points doubles.
+
+    Counts accumulate over every run profiled with the same Profiler, so a whole tape
+    file can be profiled at once. The growth timeline is the one of the longest run.
+*/
+struct SelfLoopRun {
+    uint32_t state;
+    long long length;
+    long long start_step;
+    long long start_head;
+    long long end_head;
+};
+
+struct GrowthSample {
+    long long steps;
+    long long head_pos;
+    long long lowest;           // first and last cell of the allocated pages
+    long long highest;
+    size_t pages;
+};
+
+class Profiler {
+
+    public:
+        static const size_t MAX_GROWTH_SAMPLES = 1024;
+        static const size_t TOP_LOOPS = 10;
+
+    private:
+        const CompiledMachine &cm;
+        long long sample_every;
+        vector<uint64_t> hits;                          // [state * n_symbols + symbol]
+        unordered_map<long long, long long> heat;       // head position -> samples
+        vector<SelfLoopRun> loops;                      // longest first
+        long long loop_steps = 0;                       // steps in self-loop runs
+        long long n_runs = 0;
+        long long total_steps = 0;
+
+        vector<GrowthSample> growth, longest_growth;
+        long long growth_every = 1, longest_steps = -1;
+
+        void note_loop(const SelfLoopRun &run) {
+            this->loop_steps += run.length;
+            if (this->loops.size() == TOP_LOOPS && run.length <= this->loops.back().length) {
+                return;
+            }
+            auto it = upper_bound(this->loops.begin(), this->loops.end(), run, [](const SelfLoopRun &a, const SelfLoopRun &b) {
+                return a.length > b.length;
+            });
+            this->loops.insert(it, run);
+            if (this->loops.size() > TOP_LOOPS) {
+                this->loops.pop_back();
+            }
+        }
+
+        void sample(const Tape &tape, const RunResult &run) {
+            this->heat[run.head_pos]++;
+            if (run.steps % this->growth_every != 0 && run.outcome == OUT_RUNNING) {
+                return;
+            }
+            if (this->growth.size() == MAX_GROWTH_SAMPLES) {
+                size_t kept = 0;
+                for (size_t i = 0; i < this->growth.size(); i += 2) {
+                    this->growth[kept++] = this->growth[i];
+                }
+                this->growth.resize(kept);
+                this->growth_every *= 2;
+            }
+            bool empty = (tape.page_count() == 0);
+            this->growth.push_back({run.steps, run.head_pos, empty ? 0 : tape.lowest_page_start(),
+                                    empty ? -1 : tape.highest_page_start() + Tape::PAGE_SIZE - 1, tape.page_count()});
+        }
+
+        static string percent(double part, double whole) {
+            ostringstream text;
+            text.setf(ios::fixed);
+            text.precision(1);
+            text << (whole > 0 ? 100.0 * part / whole : 0.0) << "%";
+            return text.str();
+        }
+
+        string transition_text(size_t index) const {
+            uint32_t entry = this->cm.table[index];
+            const char actions[] = {'L', 'R', 'Y', 'N'};
+            return "(" + this->cm.state_names[index / this->cm.n_symbols] + "," + this->cm.symbols[index % this->cm.n_symbols] +
+                   ") -> (" + this->cm.state_names[transition_next_state(entry)] + "," +
+                   this->cm.symbols[transition_write_symbol(entry)] + "," + actions[transition_action(entry)] + ")";
+        }
+
+        vector<uint64_t> state_hits() const {
+            vector<uint64_t> result(this->cm.n_states, 0);
+            for (size_t i = 0; i < this->hits.size(); i++) {
+                result[i / this->cm.n_symbols] += this->hits[i];
+            }
+            return result;
+        }
+
+        // Indices of the non-zero counters, most hit first
+        static vector<size_t> ranked(const vector<uint64_t> &counts) {
+            vector<size_t> order;
+            for (size_t i = 0; i < counts.size(); i++) {
+                if (counts[i] > 0) {
+                    order.push_back(i);
+                }
+            }
+            stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return counts[a] > counts[b];
+            });
+            return order;
+        }
+
+        vector<pair<long long, long long>> sorted_heat() const {
+            vector<pair<long long, long long>> cells(this->heat.begin(), this->heat.end());
+            sort(cells.begin(), cells.end());
+            return cells;
+        }
+
+    public:
+        Profiler(const CompiledMachine &cm, long long sample_every = 64)
+            : cm(cm), sample_every(max(1LL, sample_every)), hits(size_t(cm.n_states) * cm.n_symbols, 0) {}
+
+        // This function runs the machine like run_machine with the naive engine, counting every step
+        RunResult run(Tape &tape, long long head_pos, const RunOptions &options) {
+            const uint32_t *tbl = this->cm.table;
+            const uint32_t n_syms = this->cm.n_symbols;
+            uint64_t *counts = this->hits.data();
+            RunResult run = this->cm.start(head_pos);
+            long long step_limit = (options.max_steps > 0) ? options.max_steps : LLONG_MAX;
+            auto deadline = chrono::steady_clock::now() + chrono::duration<double>(options.time_limit);
+            long long next_check = options.check_stride;
+            this->growth.clear();
+            this->growth_every = 1;
+
+            SelfLoopRun current = {0, 0, 0, 0, 0};
+            long long page_start = Tape::page_start_of(run.head_pos);
+            long long offset = run.head_pos - page_start;
+            uint8_t *page = tape.page_at(page_start);
+            uint32_t state = run.state;
+            long long steps = 0;
+            sample(tape, run);
+            while (run.outcome == OUT_RUNNING && steps < step_limit) {
+                long long chunk_end = min(step_limit, steps + this->sample_every);
+                while (steps < chunk_end) {
+                    uint8_t symbol = page[offset];
+                    size_t index = size_t(state) * n_syms + symbol;
+                    uint32_t entry = tbl[index];
+                    uint8_t action = transition_action(entry);
+                    if (action == ACT_NONE) {
+                        run.outcome = OUT_NO_TRANSITION;
+                        break;
+                    }
+                    counts[index]++;
+                    uint32_t next_state = transition_next_state(entry);
+                    if (next_state == state) {
+                        if (current.length++ == 0) {
+                            current.state = state;
+                            current.start_step = steps;
+                            current.start_head = page_start + offset;
+                        }
+                    } else if (current.length > 0) {
+                        current.end_head = page_start + offset;
+                        note_loop(current);
+                        current.length = 0;
+                    }
+                    steps++;
+                    uint8_t write_symbol = transition_write_symbol(entry);
+                    if (write_symbol != symbol) {
+                        if (tape.is_blank_page(page)) {
+                            page = tape.materialize(page_start);
+                        }
+                        page[offset] = write_symbol;
+                    }
+                    state = next_state;
+                    if (action == ACT_R) {
+                        if (++offset == Tape::PAGE_SIZE) {
+                            page_start += Tape::PAGE_SIZE;
+                            offset = 0;
+                            page = tape.page_at(page_start);
+                        }
+                    } else if (action == ACT_L) {
+                        if (offset-- == 0) {
+                            page_start -= Tape::PAGE_SIZE;
+                            offset = Tape::PAGE_SIZE - 1;
+                            page = tape.page_at(page_start);
+                        }
+                    } else {
+                        run.outcome = (action == ACT_Y) ? OUT_ACCEPT : OUT_REJECT;
+                        break;
+                    }
+                }
+                run.steps = steps;
+                run.head_pos = page_start + offset;
+                run.state = state;
+                if (options.time_limit > 0 && steps >= next_check && run.outcome == OUT_RUNNING) {
+                    next_check += options.check_stride;
+                    if (chrono::steady_clock::now() >= deadline) {
+                        run.outcome = OUT_TIMEOUT;
+                    }
+                }
+                sample(tape, run);
+            }
+            if (current.length > 0) {
+                current.end_head = run.head_pos;
+                note_loop(current);
+            }
+            if (run.outcome == OUT_RUNNING) {
+                run.outcome = OUT_TIMEOUT;
+            }
+            this->n_runs++;
+            this->total_steps += run.steps;
+            if (run.steps > this->longest_steps) {
+                this->longest_steps = run.steps;
+                this->longest_growth.swap(this->growth);
+            }
+            return run;
+        }
+
+        // Prints the ranked report: hottest states and transitions, self-loop runs, head heatmap and tape growth
+        void report(ostream &out, size_t top = 10) const {
+            double total = double(this->total_steps);
+            vector<uint64_t> per_state = state_hits();
+            size_t used = 0, defined = 0;
+            for (size_t i = 0; i < this->hits.size(); i++) {
+                used += (this->hits[i] > 0);
+                defined += (transition_action(this->cm.table[i]) != ACT_NONE);
+            }
+            out << bold(underline("Profile:")) << " " << this->n_runs << " runs, " << this->total_steps << " steps, "
+                << used << " of " << defined << " transitions used" << endl;
+
+            out << bold("Hottest states:") << endl;
+            double cumulative = 0;
+            vector<size_t> states = ranked(per_state);
+            for (size_t i = 0; i < states.size() && i < top; i++) {
+                cumulative += per_state[states[i]];
+                out << "    " << this->cm.state_names[states[i]] << "\t" << per_state[states[i]] << "\t"
+                    << percent(per_state[states[i]], total) << "\t(cumulative " << percent(cumulative, total) << ")" << endl;
+            }
+
+            out << bold("Hottest transitions:") << endl;
+            vector<size_t> transitions = ranked(this->hits);
+            for (size_t i = 0; i < transitions.size() && i < top; i++) {
+                out << "    " << transition_text(transitions[i]) << "\t" << this->hits[transitions[i]] << "\t"
+                    << percent(this->hits[transitions[i]], total) << endl;
+            }
+
+            out << bold("Longest self-loop runs:") << " " << this->loop_steps << " steps ("
+                << percent(this->loop_steps, total) << ") stay in the same state" << endl;
+            for (const SelfLoopRun &run : this->loops) {
+                out << "    " << this->cm.state_names[run.state] << "\t" << run.length << " steps from step " << run.start_step
+                    << ", head " << run.start_head << " -> " << run.end_head << endl;
+            }
+
+            vector<pair<long long, long long>> cells = sorted_heat();
+            if (!cells.empty()) {
+                const long long rows = 16;
+                long long lo = cells.front().first, hi = cells.back().first;
+                long long width = (hi - lo) / rows + 1;
+                vector<long long> buckets((hi - lo) / width + 1, 0);
+                long long samples = 0, peak = 0;
+                for (auto &cell : cells) {
+                    buckets[(cell.first - lo) / width] += cell.second;
+                    samples += cell.second;
+                }
+                for (long long count : buckets) {
+                    peak = max(peak, count);
+                }
+                out << bold("Head heatmap:") << " " << samples << " samples, one every " << this->sample_every << " steps" << endl;
+                for (size_t i = 0; i < buckets.size(); i++) {
+                    long long from = lo + (long long)i * width;
+                    out << "    [" << from << ", " << from + width - 1 << "]\t" << string(size_t(40 * buckets[i] / peak), '#')
+                        << " " << percent(buckets[i], samples) << endl;
+                }
+            }
+
+            if (!this->longest_growth.empty()) {
+                out << bold("Tape growth:") << " (longest run)" << endl;
+                size_t n = this->longest_growth.size(), rows = min<size_t>(n, 10);
+                for (size_t r = 0; r < rows; r++) {
+                    const GrowthSample &sample = this->longest_growth[(rows == 1) ? 0 : r * (n - 1) / (rows - 1)];
+                    out << "    step " << sample.steps << "\thead " << sample.head_pos << "\t"
+                        << sample.pages * Tape::PAGE_SIZE << " cells allocated [" << sample.lowest << ", " << sample.highest << "]" << endl;
+                }
+            }
+        }
+
+        void export_json(ostream &out) const {
+            vector<uint64_t> per_state = state_hits();
+            out << "{\"runs\": " << this->n_runs << ", \"steps\": " << this->total_steps << ", \"sample_every\": " << this->sample_every;
+            out << ",\n \"states\": [";
+            vector<size_t> states = ranked(per_state);
+            for (size_t i = 0; i < states.size(); i++) {
+                out << (i ? ", " : "") << "{\"state\": \"" << this->cm.state_names[states[i]] << "\", \"hits\": " << per_state[states[i]] << "}";
+            }
+            out << "],\n \"transitions\": [";
+            vector<size_t> transitions = ranked(this->hits);
+            for (size_t i = 0; i < transitions.size(); i++) {
+                size_t index = transitions[i];
+                uint32_t entry = this->cm.table[index];
+                out << (i ? ",\n   " : "\n   ") << "{\"state\": \"" << this->cm.state_names[index / this->cm.n_symbols]
+                    << "\", \"symbol\": \"" << this->cm.symbols[index % this->cm.n_symbols]
+                    << "\", \"next_state\": \"" << this->cm.state_names[transition_next_state(entry)]
+                    << "\", \"write\": \"" << this->cm.symbols[transition_write_symbol(entry)]
+                    << "\", \"action\": \"" << "LRYN"[transition_action(entry)] << "\", \"hits\": " << this->hits[index] << "}";
+            }
+            out << "],\n \"self_loop_steps\": " << this->loop_steps << ", \"self_loops\": [";
+            for (size_t i = 0; i < this->loops.size(); i++) {
+                const SelfLoopRun &run = this->loops[i];
+                out << (i ? ", " : "") << "{\"state\": \"" << this->cm.state_names[run.state] << "\", \"length\": " << run.length
+                    << ", \"start_step\": " << run.start_step << ", \"start_head\": " << run.start_head << ", \"end_head\": " << run.end_head << "}";
+            }
+            out << "],\n \"heatmap\": [";
+            vector<pair<long long, long long>> cells = sorted_heat();
+            for (size_t i = 0; i < cells.size(); i++) {
+                out << (i ? ", " : "") << "[" << cells[i].first << ", " << cells[i].second << "]";
+            }
+            out << "],\n \"growth\": [";
+            for (size_t i = 0; i < this->longest_growth.size(); i++) {
+                const GrowthSample &sample = this->longest_growth[i];
+                out << (i ? ", " : "") << "{\"steps\": " << sample.steps << ", \"head\": " << sample.head_pos << ", \"lowest\": " << sample.lowest
+                    << ", \"highest\": " << sample.highest << ", \"pages\": " << sample.pages << "}";
+            }
+            out << "]}\n";
+        }
+
+        // Writes one CSV table per section, separated by blank lines
+        void export_csv(ostream &out) const {
+            vector<uint64_t> per_state = state_hits();
+            out << "state,hits\n";
+            for (size_t i : ranked(per_state)) {
+                out << this->cm.state_names[i] << ',' << per_state[i] << '\n';
+            }
+            out << "\nstate,symbol,next_state,write,action,hits\n";
+            for (size_t i : ranked(this->hits)) {
+                uint32_t entry = this->cm.table[i];
+                out << this->cm.state_names[i / this->cm.n_symbols] << ',' << this->cm.symbols[i % this->cm.n_symbols] << ','
+                    << this->cm.state_names[transition_next_state(entry)] << ',' << this->cm.symbols[transition_write_symbol(entry)] << ','
+                    << "LRYN"[transition_action(entry)] << ',' << this->hits[i] << '\n';
+            }
+            out << "\nloop_state,length,start_step,start_head,end_head\n";
+            for (const SelfLoopRun &run : this->loops) {
+                out << this->cm.state_names[run.state] << ',' << run.length << ',' << run.start_step << ',' << run.start_head << ',' << run.end_head << '\n';
+            }
+            out << "\nhead_pos,samples\n";
+            for (auto &cell : sorted_heat()) {
+                out << cell.first << ',' << cell.second << '\n';
+            }
+            out << "\nsteps,head_pos,lowest,highest,pages\n";
+            for (const GrowthSample &sample : this->longest_growth) {
+                out << sample.steps << ',' << sample.head_pos << ',' << sample.lowest << ',' << sample.highest << ',' << sample.pages << '\n';
+            }
+        }
+};
+
+// This function profiles every tape of a tape file, printing batch result lines, then the report; report_path (if given) gets a CSV or JSON export
+bool run_profile(const CompiledMachine &cm, istream &in, ostream &out, const RunOptions &options,
+                 long long sample_every, const string &report_path) {
+    Profiler profiler(cm, sample_every);
+    Tape cells;
+    string line, tape;
+    TapeJob job;
+    while (getline(in, line)) {
+        RunResult result = {OUT_INVALID_TAPE, 0, 0, cm.initial_state};
+        if (read_tape_job(cm, line, tape, job)) {
+            cm.encode_tape(job.tape, cells);
+            result = profiler.run(cells, job.head_pos, options);
+        } else {
+            result.head_pos = job.head_pos;
+        }
+        out << tape << '\t' << outcome_name(result.outcome) << '\t' << result.steps << '\t' << result.head_pos << '\n';
+    }
+    profiler.report(out);
+    if (report_path.empty()) {
+        return true;
+    }
+    ofstream file(report_path);
+    if (!file) {
+        cerr << red("Error: Cannot write " + report_path) << endl;
+        return false;
+    }
+    bool csv = report_path.size() >= 4 && report_path.compare(report_path.size() - 4, 4, ".csv") == 0;
+    if (csv) {
+        profiler.export_csv(file);
+    } else {
+        profiler.export_json(file);
+    }
+    return true;
+}
+
+/*****************************************************************/
+/************************** CHECKPOINTS **************************/
+/*****************************************************************/
+/* Checkpoints of a long run go to an append-only journal, so the run can resume after the process is killed.
+
+    Layout (varints are unsigned LEB128; signed values are zigzag-encoded first):
+    "TMCK" varint version, uint64 machine fingerprint          once, at the start
+    then one record per checkpoint:
+    "CKPT" varint outcome, steps, head, state, n_pages
+           n_pages x (varint page start, PAGE_SIZE cells)
+           uint64 FNV-1a hash of the record from "CKPT" on
+
+    A record holds only the pages dirtied since the previous record, and replaying
+    the records in order rebuilds the tape. If a kill cuts a record short, its hash
+    fails and it is dropped, so a resumed run continues from the last complete
+    checkpoint. When the journal grows past twice the tape size plus
+    CHECKPOINT_COMPACT_FLOOR, the background thread compacts it after appending the
+    next record: it replays the journal from disk, keeping the latest copy of each
+    page, and streams a single record into a temporary file that then replaces the
+    journal. The floor keeps a run on a small tape from compacting every few records.
+
+    Taking a checkpoint only copies the dirty pages into a buffer, even when it
+    triggers a compaction. A background thread writes and fsyncs it. If a checkpoint
+    falls due while the previous one is still being written, it is deferred to the
+    next chunk, and its pages stay dirty.
+*/
+const uint32_t CHECKPOINT_FORMAT_VERSION = 1;
+const long long CHECKPOINT_COMPACT_FLOOR = 1 << 20;
+
+static uint64_t fnv1a(const void *data, size_t n, uint64_t hash = 0xcbf29ce484222325ULL) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t zigzag(long long value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static long long unzigzag(uint64_t value) {
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+static void write_uint64(string &out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out += char(value >> (8 * i));
+    }
+}
+
+static uint64_t read_uint64(const uint8_t *p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= uint64_t(p[i]) << (8 * i);
+    }
+    return value;
+}
+
+// Identifies a machine, so a checkpoint is only resumed with the machine that wrote it
+uint64_t machine_fingerprint(const CompiledMachine &cm) {
+    uint32_t header[5] = {cm.n_states, cm.n_symbols, cm.initial_state, cm.blank, cm.left_mark};
+    uint64_t hash = fnv1a(header, sizeof(header));
+    hash = fnv1a(cm.symbols.data(), cm.symbols.size(), hash);
+    for (const string &name : cm.state_names) {
+        hash = fnv1a(name.c_str(), name.size() + 1, hash);
+    }
+    return fnv1a(cm.table, size_t(cm.n_states) * cm.n_symbols * sizeof(uint32_t), hash);
+}
+
+typedef vector<pair<long long, const uint8_t *>> CheckpointPages;      // page start -> PAGE_SIZE cells
+
+// Encodes a checkpoint record of the run with the given pages of the tape
+string checkpoint_record(const RunResult &run, const Tape &tape, const vector<long long> &pages) {
+    string record = "CKPT";
+    record.reserve(64 + pages.size() * (Tape::PAGE_SIZE + 10));
+    write_varint(record, run.outcome);
+    write_varint(record, run.steps);
+    write_varint(record, zigzag(run.head_pos));
+    write_varint(record, run.state);
+    write_varint(record, pages.size());
+    for (long long start : pages) {
+        write_varint(record, zigzag(start));
+        record.append(reinterpret_cast<const char *>(tape.page_at(start)), Tape::PAGE_SIZE);
+    }
+    write_uint64(record, fnv1a(record.data(), record.size()));
+    return record;
+}
+
+/* This function reads the records of a journal from p (just past the header) until one is incomplete.
+
+    Each complete record is passed to apply, with its pages pointing into the journal.
+    Returns the end of the last complete record, or nullptr if apply returned false.
+*/
+static const uint8_t *read_checkpoint_records(const uint8_t *p, const uint8_t *end, uint32_t n_states,
+                                              const function<bool(const RunResult &, const CheckpointPages &)> &apply) {
+    const uint8_t *valid_end = p;
+    CheckpointPages pages;
+    while (end - p >= 4 && memcmp(p, "CKPT", 4) == 0) {
+        const uint8_t *record = p;
+        p += 4;
+        uint64_t outcome, steps, head, state, n_pages;
+        if (!read_varint(p, end, outcome) || !read_varint(p, end, steps) || !read_varint(p, end, head) ||
+            !read_varint(p, end, state) || !read_varint(p, end, n_pages) || outcome > OUT_LOOP || state >= n_states) {
+            break;
+        }
+        // Check the whole record before applying any of its pages
+        pages.clear();
+        bool complete = true;
+        for (uint64_t i = 0; i < n_pages && complete; i++) {
+            uint64_t start;
+            complete = read_varint(p, end, start) && uint64_t(end - p) >= uint64_t(Tape::PAGE_SIZE);
+            if (complete) {
+                pages.emplace_back(unzigzag(start), p);
+                p += Tape::PAGE_SIZE;
+            }
+        }
+        if (!complete || end - p < 8 || read_uint64(p) != fnv1a(record, size_t(p - record))) {
+            break;
+        }
+        p += 8;
+        if (!apply({Outcome(outcome), (long long)steps, unzigzag(head), uint32_t(state)}, pages)) {
+            return nullptr;
+        }
+        valid_end = p;
+    }
+    return valid_end;
+}
+
+/* This function replays a checkpoint journal into the tape and run state.
+
+    Returns false when the file cannot be read, is not a journal, was written for another
+    machine or holds no complete record. valid_bytes is set to the length of the journal
+    up to the end of the last complete record.
+*/
+bool load_checkpoint(const string &path, const CompiledMachine &cm, Tape &tape, RunResult &run, size_t &valid_bytes) {
+    auto fail = [&](string message) {
+        cerr << red("Error: " + path + ": " + message) << endl;
+        return false;
+    };
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return fail("Cannot open checkpoint.");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 13) {
+        close(fd);
+        return fail("Truncated checkpoint.");
+    }
+    size_t size = info.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return fail("Cannot map checkpoint.");
+    }
+    shared_ptr<const void> owner(mapping, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+
+    const uint8_t *base = static_cast<const uint8_t *>(mapping);
+    const uint8_t *p = base + 4, *end = base + size;
+    uint64_t version;
+    if (memcmp(base, "TMCK", 4) != 0) {
+        return fail("Not a checkpoint.");
+    }
+    if (!read_varint(p, end, version) || version != CHECKPOINT_FORMAT_VERSION) {
+        return fail("Unsupported checkpoint version.");
+    }
+    if (end - p < 8 || read_uint64(p) != machine_fingerprint(cm)) {
+        return fail("The checkpoint was written by a different machine.");
+    }
+    p += 8;
+
+    tape.reset(cm.blank);
+    bool found = false;
+    const uint8_t *valid_end = read_checkpoint_records(p, end, cm.n_states, [&](const RunResult &record, const CheckpointPages &pages) {
+        for (const auto &page : pages) {
+            for (long long i = 0; i < Tape::PAGE_SIZE; i++) {
+                if (page.second[i] >= cm.n_symbols) {
+                    return false;
+                }
+            }
+            memcpy(tape.materialize(page.first), page.second, Tape::PAGE_SIZE);
+        }
+        run = record;
+        found = true;
+        return true;
+    });
+    if (valid_end == nullptr) {
+        return fail("Corrupt tape cell in checkpoint.");
+    }
+    if (!found) {
+        return fail("The checkpoint holds no complete record.");
+    }
+    valid_bytes = size_t(valid_end - base);
+    return true;
+}
+
+class CheckpointJournal {
+
+    private:
+        string path;
+        string header;
+        int fd = -1;
+        thread writer;
+        mutex lock;
+        condition_variable wake;
+        string pending;                 // record handed over by the run, not yet taken by the writer
+        bool has_pending = false;
+        bool pending_compact = false;
+        bool writing = false;
+        bool stopping = false;
+        bool failed = false;
+        atomic<long long> size{0};
+        atomic<long long> n_records{0};
+        atomic<long long> n_bytes{0};
+
+        static bool write_all(int fd, const string &data) {
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t n = write(fd, data.data() + done, data.size() - done);
+                if (n < 0) {
+                    return false;
+                }
+                done += n;
+            }
+            return true;
+        }
+
+        // Folds the journal into one record with the latest copy of every page, in a temporary file that replaces it
+        bool compact() {
+            int in = ::open(this->path.c_str(), O_RDONLY);
+            struct stat info;
+            if (in < 0 || fstat(in, &info) != 0 || info.st_size < (off_t)this->header.size()) {
+                if (in >= 0) {
+                    ::close(in);
+                }
+                return false;
+            }
+            size_t size = info.st_size;
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, in, 0);
+            ::close(in);
+            if (mapping == MAP_FAILED) {
+                return false;
+            }
+            shared_ptr<const void> owner(mapping, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+            const uint8_t *base = static_cast<const uint8_t *>(mapping);
+
+            map<long long, const uint8_t *> latest;
+            RunResult run;
+            bool found = false;
+            read_checkpoint_records(base + this->header.size(), base + size, UINT32_MAX, [&](const RunResult &record, const CheckpointPages &pages) {
+                for (const auto &page : pages) {
+                    latest[page.first] = page.second;
+                }
+                run = record;
+                found = true;
+                return true;
+            });
+            if (!found) {
+                return false;
+            }
+
+            // The record is streamed out through a bounded buffer, hashing as it goes
+            string temporary = this->path + ".tmp";
+            int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out < 0) {
+                return false;
+            }
+            bool ok = write_all(out, this->header);
+            long long written = this->header.size();
+            uint64_t hash = fnv1a(nullptr, 0);
+            string buffer = "CKPT";
+            write_varint(buffer, run.outcome);
+            write_varint(buffer, run.steps);
+            write_varint(buffer, zigzag(run.head_pos));
+            write_varint(buffer, run.state);
+            write_varint(buffer, latest.size());
+            auto flush = [&]() {
+                hash = fnv1a(buffer.data(), buffer.size(), hash);
+                ok = ok && write_all(out, buffer);
+                written += buffer.size();
+                buffer.clear();
+            };
+            for (const auto &page : latest) {
+                write_varint(buffer, zigzag(page.first));
+                buffer.append(reinterpret_cast<const char *>(page.second), Tape::PAGE_SIZE);
+                if (buffer.size() >= (1 << 20)) {
+                    flush();
+                }
+            }
+            flush();
+            write_uint64(buffer, hash);
+            ok = ok && write_all(out, buffer);
+            written += buffer.size();
+            ok = ok && fsync(out) == 0;
+            ::close(out);
+            if (!ok || rename(temporary.c_str(), this->path.c_str()) != 0) {
+                return false;
+            }
+            ::close(this->fd);
+            this->fd = ::open(this->path.c_str(), O_WRONLY | O_APPEND);
+            this->size = written;
+            return this->fd >= 0;
+        }
+
+        bool write_record(const string &record, bool compacting) {
+            if (!write_all(this->fd, record) || fsync(this->fd) != 0) {
+                return false;
+            }
+            this->size += record.size();
+            return !compacting || compact();
+        }
+
+        void work() {
+            unique_lock<mutex> guard(this->lock);
+            while (true) {
+                this->wake.wait(guard, [this]() { return this->has_pending || this->stopping; });
+                if (!this->has_pending) {
+                    return;
+                }
+                string record;
+                record.swap(this->pending);
+                bool compacting = this->pending_compact;
+                this->has_pending = false;
+                this->writing = true;
+                guard.unlock();
+                bool ok = write_record(record, compacting);
+                guard.lock();
+                this->writing = false;
+                this->failed = this->failed || !ok;
+                this->n_records++;
+                this->n_bytes += record.size();
+                this->wake.notify_all();
+            }
+        }
+
+    public:
+        CheckpointJournal() = default;
+        CheckpointJournal(const CheckpointJournal &) = delete;
+        CheckpointJournal &operator=(const CheckpointJournal &) = delete;
+
+        ~CheckpointJournal() {
+            close();
+        }
+
+        // Creates a new journal for the machine, or appends to an existing one after its first valid_bytes
+        bool open(const string &path, uint64_t fingerprint, bool append, size_t valid_bytes = 0) {
+            this->path = path;
+            this->header = "TMCK";
+            write_varint(this->header, CHECKPOINT_FORMAT_VERSION);
+            write_uint64(this->header, fingerprint);
+            if (append) {
+                this->fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+                if (this->fd < 0 || ftruncate(this->fd, valid_bytes) != 0) {
+                    return false;
+                }
+                this->size = valid_bytes;
+            } else {
+                this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+                if (this->fd < 0 || !write_all(this->fd, this->header)) {
+                    return false;
+                }
+                this->size = this->header.size();
+            }
+            this->writer = thread(&CheckpointJournal::work, this);
+            return true;
+        }
+
+        // True while a checkpoint is waiting for or being written
+        bool busy() {
+            lock_guard<mutex> guard(this->lock);
+            return this->has_pending || this->writing;
+        }
+
+        // Hands a record to the writer thread, which compacts the journal after appending it if asked to
+        void submit(string &&record, bool compacting) {
+            lock_guard<mutex> guard(this->lock);
+            this->pending = move(record);
+            this->pending_compact = compacting;
+            this->has_pending = true;
+            this->wake.notify_all();
+        }
+
+        // Waits until every submitted checkpoint is on disk. Returns false if any write failed.
+        bool wait() {
+            unique_lock<mutex> guard(this->lock);
+            this->wake.wait(guard, [this]() { return !this->has_pending && !this->writing; });
+            return !this->failed;
+        }
+
+        void close() {
+            if (this->writer.joinable()) {
+                {
+                    lock_guard<mutex> guard(this->lock);
+                    this->stopping = true;
+                    this->wake.notify_all();
+                }
+                this->writer.join();
+            }
+            if (this->fd >= 0) {
+                ::close(this->fd);
+                this->fd = -1;
+            }
+        }
+
+        long long journal_size() const {
+            return this->size;
+        }
+
+        long long records_written() const {
+            return this->n_records;
+        }
+
+        long long bytes_written() const {
+            return this->n_bytes;
+        }
+};
+
+static volatile sig_atomic_t checkpoint_interrupted = 0;
+
+static void interrupt_checkpointed_run(int) {
+    checkpoint_interrupted = 1;
+}
+
+/* This function continues a run, checkpointing it to the journal every `every` seconds.
+
+    The run advances in chunks of check_stride steps, with either engine; the clock,
+    the limits and the loop detector are checked between chunks. SIGINT and SIGTERM end
+    the run after the current chunk, leaving it OUT_RUNNING. A last checkpoint is
+    always written, so a finished run resumes straight to its result.
+*/
+RunResult run_checkpointed(const CompiledMachine &cm, Tape &tape, RunResult run, const RunOptions &options,
+                           CheckpointJournal &journal, double every) {
+    AcceleratedEngine accelerator(cm);
+    unique_ptr<LoopDetector> detector;
+    if (options.detect_loops) {
+        detector.reset(new LoopDetector(cm));
+    }
+    long long step_limit = (options.max_steps > 0) ? options.max_steps : LLONG_MAX;
+    auto now = chrono::steady_clock::now();
+    auto deadline = now + chrono::duration<double>(options.time_limit);
+    auto next_checkpoint = now + chrono::duration<double>(0);
+
+    auto checkpoint = [&]() {
+        vector<long long> pages = tape.take_dirty();
+        bool compacting = journal.journal_size() > 2 * (long long)(tape.page_count() * Tape::PAGE_SIZE) + CHECKPOINT_COMPACT_FLOOR;
+        journal.submit(checkpoint_record(run, tape, pages), compacting);
+    };
+
+    checkpoint_interrupted = 0;
+    auto previous_int = signal(SIGINT, interrupt_checkpointed_run);
+    auto previous_term = signal(SIGTERM, interrupt_checkpointed_run);
+    while (run.outcome == OUT_RUNNING && run.steps < step_limit && !checkpoint_interrupted) {
+        now = chrono::steady_clock::now();
+        if (now >= next_checkpoint && !journal.busy()) {
+            checkpoint();
+            next_checkpoint = now + chrono::duration<double>(every);
+        }
+        if (options.time_limit > 0 && now >= deadline) {
+            run.outcome = OUT_TIMEOUT;
+            break;
+        }
+        long long target = min(step_limit, run.steps + options.check_stride);
+        if (options.engine == ENGINE_ACCELERATED) {
+            accelerator.advance(tape, run, target);
+        } else {
+            cm.advance(tape, run, target);
+        }
+        if (run.outcome == OUT_RUNNING && detector && detector->proves_loop(tape, run)) {
+            run.outcome = OUT_LOOP;
+        }
+    }
+    if (run.outcome == OUT_RUNNING && run.steps >= step_limit) {
+        run.outcome = OUT_TIMEOUT;
+    }
+    signal(SIGINT, previous_int);
+    signal(SIGTERM, previous_term);
+    journal.wait();
+    checkpoint();
+    return run;
+}
+
+// This function runs the first tape of a tape file with checkpoints to path, or resumes the run checkpointed in path
+bool run_with_checkpoints(const CompiledMachine &cm, istream &in, ostream &out, const RunOptions &options,
+                          const string &path, double every, bool resume) {
+    Tape tape;
+    RunResult run = cm.start(1);
+    size_t valid_bytes = 0;
+    if (resume) {
+        if (!load_checkpoint(path, cm, tape, run, valid_bytes)) {
+            return false;
+        }
+    } else {
+        string line, input;
+        TapeJob job;
+        getline(in, line);
+        if (!read_tape_job(cm, line, input, job)) {
+            out << input << '\t' << outcome_name(OUT_INVALID_TAPE) << "\t0\t" << job.head_pos << '\n';
+            return false;
+        }
+        cm.encode_tape(job.tape, tape);
+        run = cm.start(job.head_pos);
+    }
+
+    if (run.outcome == OUT_RUNNING) {
+        CheckpointJournal journal;
+        if (!journal.open(path, machine_fingerprint(cm), resume, valid_bytes)) {
+            cerr << red("Error: Cannot write checkpoint " + path) << endl;
+            return false;
+        }
+        tape.track_dirty();
+        if (resume) {
+            tape.take_dirty();      // already in the journal
+        }
+        run = run_checkpointed(cm, tape, run, options, journal, every);
+        bool written = journal.wait();
+        cerr << journal.records_written() << " checkpoints, " << journal.bytes_written() << " bytes written, journal "
+             << journal.journal_size() << " bytes" << endl;
+        if (!written) {
+            cerr << red("Error: Cannot write checkpoint " + path) << endl;
+            return false;
+        }
+    }
+    out << outcome_name(run.outcome) << '\t' << run.steps << '\t' << run.head_pos << '\n';
+    return true;
+}
+
+/*****************************************************************/
+/*************************** OPTIMIZER ***************************/
+/*****************************************************************/
+/* Shrinks a compiled machine before it runs, without changing the outcome, the final tape or the final head position.
+
+    Passes, in order:
+    1. Bounce folding. A bounce state moves back the way it came on every symbol,
+       without writing, and always goes to the same state r. A transition that moves
+       into it without writing returns the head to the same cell in state r with the
+       tape unchanged, so it is replaced by r's transition on the same symbol. Chains
+       of bounces are followed; a chain that cycles is left alone.
+    2. Unreachable states. States that no move from the initial state can reach are
+       dropped. A state only entered by a halting transition is never run, so a
+       halting transition into it reports its source state instead.
+    3. Minimization. States are merged Moore-style. The first partition is by the
+       (write, action) of each symbol. Blocks are then split by the blocks of their
+       L/R targets until nothing changes. Halting transitions compare only write and
+       action.
+
+    Folding saves two steps per bounce, so the step count of a run may go down.
+
+    The analysis also flags (state, symbol) pairs that can never fire for tapes over
+    the input alphabet. Such a symbol is not an input symbol, a blank or the left
+    mark, and no reachable transition writes it. The left mark is a special case. If
+    it is never written anywhere else, only the initial state and states entered by
+    a left move can read it. The report also lists the states that halt immediately
+    on every symbol they can read. These are only reported; the pairs stay in the
+    table, since batch tapes may use any tape symbol.
+*/
+struct OptimizeReport {
+    uint32_t states_before = 0, states_after = 0;
+    size_t transitions_before = 0, transitions_after = 0;
+    uint32_t unreachable_states = 0;
+    uint32_t merged_states = 0;
+    size_t folded = 0;
+    vector<pair<uint32_t, uint8_t>> dead_pairs;         // defined (state, symbol) pairs of the optimized machine that never fire
+    vector<pair<uint32_t, char>> halting_states;        // state of the optimized machine, 'Y', 'N' or '?' (mixed or error)
+};
+
+static size_t count_transitions(const CompiledMachine &cm) {
+    size_t n = 0;
+    for (size_t i = 0; i < size_t(cm.n_states) * cm.n_symbols; i++) {
+        n += (transition_action(cm.table[i]) != ACT_NONE);
+    }
+    return n;
+}
+
+// This function returns the optimized machine and fills in the report
+CompiledMachine optimize_machine(const CompiledMachine &cm, OptimizeReport &report) {
+    const uint32_t n_states = cm.n_states, n_symbols = cm.n_symbols;
+    vector<uint32_t> table(cm.table, cm.table + size_t(n_states) * n_symbols);
+    auto entry = [&](uint32_t state, uint32_t symbol) -> uint32_t & {
+        return table[size_t(state) * n_symbols + symbol];
+    };
+    report = OptimizeReport();
+    report.states_before = n_states;
+    report.transitions_before = count_transitions(cm);
+
+    // 1. Bounce folding: bounce_action[p] is the move p makes on every symbol (ACT_NONE if p is not a bounce state)
+    vector<uint8_t> bounce_action(n_states, ACT_NONE);
+    vector<uint32_t> bounce_target(n_states, 0);
+    for (uint32_t p = 0; p < n_states; p++) {
+        uint32_t first = entry(p, 0);
+        uint8_t action = transition_action(first);
+        bool bounces = (action == ACT_L || action == ACT_R);
+        for (uint32_t x = 0; x < n_symbols && bounces; x++) {
+            uint32_t e = entry(p, x);
+            bounces = transition_action(e) == action && transition_write_symbol(e) == x &&
+                      transition_next_state(e) == transition_next_state(first);
+        }
+        if (bounces) {
+            bounce_action[p] = action;
+            bounce_target[p] = transition_next_state(first);
+        }
+    }
+    vector<uint32_t> folded_table = table;
+    vector<uint32_t> seen(n_states, UINT32_MAX);
+    for (uint32_t q = 0; q < n_states; q++) {
+        for (uint32_t s = 0; s < n_symbols; s++) {
+            uint32_t e = entry(q, s);
+            uint32_t stamp = q * n_symbols + s;
+            bool changed = false, cycles = false;
+            for (;;) {
+                uint8_t action = transition_action(e);
+                uint32_t p = transition_next_state(e);
+                if ((action != ACT_L && action != ACT_R) || transition_write_symbol(e) != s ||
+                    bounce_action[p] != (action == ACT_L ? ACT_R : ACT_L)) {
+                    break;
+                }
+                uint32_t r = bounce_target[p];
+                if (seen[r] == stamp) {
+                    cycles = true;
+                    break;
+                }
+                seen[r] = stamp;
+                e = entry(r, s);
+                changed = true;
+            }
+            if (changed && !cycles) {
+                folded_table[size_t(q) * n_symbols + s] = e;
+                report.folded++;
+            }
+        }
+    }
+    table.swap(folded_table);
+
+    // 2. States reachable from the initial state by moves
+    vector<bool> reachable(n_states, false);
+    vector<uint32_t> stack = {cm.initial_state};
+    reachable[cm.initial_state] = true;
+    while (!stack.empty()) {
+        uint32_t q = stack.back();
+        stack.pop_back();
+        for (uint32_t s = 0; s < n_symbols; s++) {
+            uint32_t e = entry(q, s);
+            uint8_t action = transition_action(e);
+            uint32_t next = transition_next_state(e);
+            if ((action == ACT_L || action == ACT_R) && !reachable[next]) {
+                reachable[next] = true;
+                stack.push_back(next);
+            }
+        }
+    }
+
+    // 3. Moore minimization over the reachable states
+    vector<uint32_t> block(n_states, UINT32_MAX);
+    uint32_t n_blocks = 0;
+    for (bool first_round = true; ; first_round = false) {
+        map<vector<uint32_t>, uint32_t> signatures;
+        vector<uint32_t> next_block(n_states, UINT32_MAX);
+        vector<uint32_t> signature(n_symbols * 2 + 1);
+        for (uint32_t q = 0; q < n_states; q++) {
+            if (!reachable[q]) {
+                continue;
+            }
+            signature[0] = first_round ? 0 : block[q];
+            for (uint32_t s = 0; s < n_symbols; s++) {
+                uint32_t e = entry(q, s);
+                uint8_t action = transition_action(e);
+                signature[1 + 2 * s] = pack_transition(0, transition_write_symbol(e), action);
+                signature[2 + 2 * s] = (first_round || (action != ACT_L && action != ACT_R)) ? UINT32_MAX : block[transition_next_state(e)];
+            }
+            next_block[q] = signatures.emplace(signature, uint32_t(signatures.size())).first->second;
+        }
+        bool stable = (signatures.size() == n_blocks);
+        block.swap(next_block);
+        n_blocks = signatures.size();
+        if (stable && !first_round) {
+            break;
+        }
+    }
+
+    // Number the blocks by their first state, keeping the sorted order of the names
+    vector<uint32_t> block_id(n_blocks, UINT32_MAX), representative;
+    for (uint32_t q = 0; q < n_states; q++) {
+        if (reachable[q] && block_id[block[q]] == UINT32_MAX) {
+            block_id[block[q]] = representative.size();
+            representative.push_back(q);
+        }
+    }
+
+    CompiledMachine result = cm;
+    result.n_states = representative.size();
+    result.state_names.clear();
+    for (uint32_t q : representative) {
+        result.state_names.push_back(cm.state_names[q]);
+    }
+    result.initial_state = block_id[block[cm.initial_state]];
+    uint32_t *out = result.allocate_table(pack_transition(0, 0, ACT_NONE));
+    for (uint32_t i = 0; i < result.n_states; i++) {
+        uint32_t q = representative[i];
+        for (uint32_t s = 0; s < n_symbols; s++) {
+            uint32_t e = entry(q, s);
+            uint8_t action = transition_action(e);
+            if (action == ACT_NONE) {
+                continue;
+            }
+            uint32_t next = transition_next_state(e);
+            uint32_t target = reachable[next] ? block_id[block[next]] : i;
+            out[size_t(i) * n_symbols + s] = pack_transition(target, transition_write_symbol(e), action);
+        }
+    }
+    report.states_after = result.n_states;
+    report.transitions_after = count_transitions(result);
+    report.unreachable_states = n_states - count(reachable.begin(), reachable.end(), true);
+    report.merged_states = n_states - report.unreachable_states - result.n_states;
+
+    // Symbols that can be read: input symbols, the blank, the left mark, then whatever transitions that can fire write
+    const string &inputs = result.input_alphabet.empty() ? result.tape_alphabet : result.input_alphabet;
+    vector<bool> possible(n_symbols, false);
+    for (char c : inputs) {
+        possible[result.symbol_ids[(unsigned char)c]] = true;
+    }
+    possible[result.blank] = possible[result.left_mark] = true;
+    bool mark_written = false, changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t q = 0; q < result.n_states; q++) {
+            for (uint32_t s = 0; s < n_symbols; s++) {
+                uint32_t e = out[size_t(q) * n_symbols + s];
+                uint8_t write = transition_write_symbol(e);
+                if (!possible[s] || transition_action(e) == ACT_NONE) {
+                    continue;
+                }
+                if (!possible[write]) {
+                    possible[write] = changed = true;
+                }
+                mark_written = mark_written || (write == result.left_mark && s != result.left_mark);
+            }
+        }
+    }
+    // A state reads the mark if it starts the run, is entered by an L move, or, once the head can pass left of
+    // the mark, is entered by an R move (from cell -1)
+    vector<bool> reads_mark(result.n_states, mark_written);
+    reads_mark[result.initial_state] = true;
+    bool passes_mark = false;
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < size_t(result.n_states) * n_symbols; i++) {
+            uint8_t action = transition_action(out[i]);
+            uint32_t next = transition_next_state(out[i]);
+            if (!passes_mark && action == ACT_L && i % n_symbols == result.left_mark && reads_mark[i / n_symbols]) {
+                passes_mark = changed = true;
+            }
+            if ((action == ACT_L || (action == ACT_R && passes_mark)) && !reads_mark[next]) {
+                reads_mark[next] = changed = true;
+            }
+        }
+    }
+    for (uint32_t q = 0; q < result.n_states; q++) {
+        bool accepts = true, rejects = true, halts = true;
+        for (uint32_t s = 0; s < n_symbols; s++) {
+            uint8_t action = transition_action(out[size_t(q) * n_symbols + s]);
+            bool fires = possible[s] && (s != result.left_mark || reads_mark[q]);
+            if (!fires) {
+                if (action != ACT_NONE) {
+                    report.dead_pairs.emplace_back(q, uint8_t(s));
+                }
+                continue;
+            }
+            accepts = accepts && action == ACT_Y;
+            rejects = rejects && action == ACT_N;
+            halts = halts && action != ACT_L && action != ACT_R;
+        }
+        if (halts) {
+            report.halting_states.emplace_back(q, accepts ? 'Y' : rejects ? 'N' : '?');
+        }
+    }
+    return result;
+}
+
+// This function runs the optimized machine on a tape and returns false if a transition reported dead fires
+bool check_dead_pairs(const CompiledMachine &optimized, const OptimizeReport &report, const string &tape, long long max_steps) {
+    vector<bool> dead(size_t(optimized.n_states) * optimized.n_symbols, false);
+    for (const auto &pair : report.dead_pairs) {
+        dead[size_t(pair.first) * optimized.n_symbols + pair.second] = true;
+    }
+    Tape cells;
+    optimized.encode_tape(tape, cells);
+    RunResult run = optimized.start(1);
+    while (run.outcome == OUT_RUNNING && run.steps < max_steps) {
+        size_t pair = size_t(run.state) * optimized.n_symbols + cells.get(run.head_pos);
+        optimized.advance(cells, run, run.steps + 1);
+        if (dead[pair] && run.outcome != OUT_NO_TRANSITION) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_optimize_report(const CompiledMachine &optimized, const OptimizeReport &report, ostream &out) {
+    out << bold(underline("Optimizer:")) << " " << report.states_before << " -> " << report.states_after << " states, "
+        << report.transitions_before << " -> " << report.transitions_after << " transitions ("
+        << size_t(report.states_before) * optimized.n_symbols * 4 << " -> " << size_t(report.states_after) * optimized.n_symbols * 4
+        << " table bytes)" << endl;
+    out << "    " << report.unreachable_states << " unreachable states removed, " << report.merged_states << " states merged, "
+        << report.folded << " bounce transitions folded" << endl;
+    const size_t shown = 10;
+    out << "    " << report.dead_pairs.size() << " transitions can never fire on tapes over the input alphabet";
+    for (size_t i = 0; i < report.dead_pairs.size() && i < shown; i++) {
+        out << (i ? ", " : ": ") << "(" << optimized.state_names[report.dead_pairs[i].first] << ","
+            << optimized.symbols[report.dead_pairs[i].second] << ")";
+    }
+    out << (report.dead_pairs.size() > shown ? ", ..." : "") << endl;
+    out << "    " << report.halting_states.size() << " states halt immediately";
+    for (size_t i = 0; i < report.halting_states.size() && i < shown; i++) {
+        char kind = report.halting_states[i].second;
+        out << (i ? ", " : ": ") << optimized.state_names[report.halting_states[i].first]
+            << (kind == 'Y' ? " (accept)" : kind == 'N' ? " (reject)" : "");
+    }
+    out << (report.halting_states.size() > shown ? ", ..." : "") << endl;
+}
+
+/* This function runs every tape of a tape file on the original and the optimized machine.
+
+    It reports the steps and time of both, the speedup, and the tapes whose outcome,
+    final tape or final head position differ (which would be an optimizer bug).
+*/
+bool benchmark_optimizer(const CompiledMachine &original, const CompiledMachine &optimized, istream &in, const RunOptions &options) {
+    vector<string> tapes;
+    vector<TapeJob> jobs;
+    string line;
+    while (getline(in, line)) {
+        tapes.emplace_back();
+        jobs.emplace_back();
+        read_tape_job(original, line, tapes.back(), jobs.back());
+    }
+
+    const CompiledMachine *machines[2] = {&original, &optimized};
+    long long steps[2] = {0, 0};
+    double seconds[2] = {0, 0};
+    vector<RunResult> results[2];
+    vector<string> finals[2];
+    Tape cells;
+    for (int m = 0; m < 2; m++) {
+        for (const TapeJob &job : jobs) {
+            RunResult result = {OUT_INVALID_TAPE, 0, job.head_pos, machines[m]->initial_state};
+            string final_tape;
+            if (job.valid) {
+                machines[m]->encode_tape(job.tape, cells);
+                auto start = chrono::steady_clock::now();
+                result = run_machine(*machines[m], cells, job.head_pos, options);
+                seconds[m] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                pair<long long, long long> written = cells.nonblank_range();
+                final_tape = to_string(written.first) + ":" + machines[m]->decode_tape(cells, written.first, written.second + 1);
+            }
+            steps[m] += result.steps;
+            results[m].push_back(result);
+            finals[m].push_back(final_tape);
+        }
+    }
+
+    size_t differ = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (results[0][i].outcome == OUT_TIMEOUT || results[1][i].outcome == OUT_TIMEOUT) {
+            continue;
+        }
+        if (results[0][i].outcome != results[1][i].outcome || results[0][i].head_pos != results[1][i].head_pos || finals[0][i] != finals[1][i]) {
+            if (differ++ < 10) {
+                cout << red("Differs: ") << tapes[i] << '\t' << outcome_name(results[0][i].outcome) << " / " << outcome_name(results[1][i].outcome) << endl;
+            }
+        }
+    }
+    cout << bold("Tapes: ") << jobs.size() << ", " << (differ == 0 ? green("all agree") : red(to_string(differ) + " differ")) << endl;
+    cout << bold("Original: ") << steps[0] << " steps, " << seconds[0] * 1e3 << " ms" << endl;
+    cout << bold("Optimized: ") << steps[1] << " steps, " << seconds[1] * 1e3 << " ms" << endl;
+    cout << bold("Speedup: ") << (seconds[1] > 0 ? seconds[0] / seconds[1] : 1.0) << "x" << endl;
+    return differ == 0;
+}
+
+/*****************************************************************/
+/*********************** UNIVERSAL MACHINE ***********************/
+/*****************************************************************/
+/* A universal Turing machine that runs the unary machine code of another machine M.
+
+    The UTM is an ordinary machine definition, built below from a handful of loops
+    and run by the same engines as any other machine. Its input tape holds, after
+    its own left mark:
+
+    %STATE%BLANK%P<machine code>%<cells>
+
+    STATE   M's current state as 1^i 0^(K-i), K = number of states of M
+    BLANK   M's blank '#' as a cell (all zeros if '#' is not a tape symbol of M)
+    P       the cursor: marks the separator before the transition being examined
+    cells   M's tape from cell 0, each cell a separator followed by W = |tape symbols|
+            bits holding symbol j as 1^j 0^(W-j); the separator is H before the
+            head cell and c before every other cell
+
+    States, symbols and actions are numbered as in get_machine_code(), and symbols
+    outside M's tape alphabet (such as the left mark when M has no transition for
+    it) are stored as all zeros, which no transition matches.
+
+    One step of M takes one scan over the transitions: the state and symbol fields
+    of the transition after P are compared in unary with STATE and the head cell by
+    marking one '1' on each side per pass (1 -> X); on a mismatch the marks are
+    undone and P moves to the next transition. On a match the head cell and STATE
+    are cleared and refilled from the write and next-state fields, and the action
+    field moves H, halts with Y/N, or extends the tape by copying BLANK past its
+    right end. Moving left of the first cell shifts all cells right by one cell
+    (one cell shift per BLANK bit, leaving holes h) and fills the holes with a copy
+    of BLANK. Running out of transitions halts the UTM with no transition, as M would.
+*/
+class UtmBuilder {
+
+    private:
+        const string alphabet = "<#%01XZPcHh";
+        set<string> states;
+        vector<string> transitions;
+
+    public:
+        void add(const string &state, char read, const string &next_state, char write, char action) {
+            this->states.insert(state);
+            this->states.insert(next_state);
+            this->transitions.push_back("(" + state + "," + read + ") -> (" + next_state + "," + write + "," + action + ")");
+        }
+
+        // Moves in direction action over every symbol except those in stops
+        void pass(const string &state, char action, const string &stops) {
+            for (char symbol : this->alphabet) {
+                if (stops.find(symbol) == string::npos) {
+                    add(state, symbol, state, symbol, action);
+                }
+            }
+        }
+
+        string definition(const string &initial_state) {
+            string text = "states:";
+            for (const string &state : this->states) {
+                text += " " + state;
+            }
+            text += "\ninput: % 0 1 P c H\ntape:";
+            for (char symbol : this->alphabet) {
+                text += string(" ") + symbol;
+            }
+            text += "\ninitial: " + initial_state + "\n";
+            for (const string &transition : this->transitions) {
+                text += transition + "\n";
+            }
+            return text;
+        }
+};
+
+string build_utm_definition() {
+    UtmBuilder b;
+
+    // Start at the cursor on the first transition
+    b.pass("start", 'R', "P");
+    b.add("start", 'P', "cs_scan", 'P', 'R');
+
+    // Compare the state field with STATE: mark one 1 on each side per pass
+    b.add("cs_scan", 'X', "cs_scan", 'X', 'R');
+    b.add("cs_scan", '1', "cs_go_state", 'X', 'L');
+    b.add("cs_scan", '0', "cs_check_go", '0', 'L');
+    b.pass("cs_go_state", 'L', "<");
+    b.add("cs_go_state", '<', "cs_state0", '<', 'R');
+    b.add("cs_state0", '%', "cs_state", '%', 'R');
+    b.add("cs_state", 'X', "cs_state", 'X', 'R');
+    b.add("cs_state", '1', "cs_back", 'X', 'R');
+    b.add("cs_state", '0', "mm_go_left", '0', 'L');
+    b.add("cs_state", '%', "mm_go_left", '%', 'L');
+    b.pass("cs_back", 'R', "P");
+    b.add("cs_back", 'P', "cs_scan", 'P', 'R');
+    // The field ran out: STATE matches if it has no unmarked 1 left
+    b.pass("cs_check_go", 'L', "<");
+    b.add("cs_check_go", '<', "cs_check0", '<', 'R');
+    b.add("cs_check0", '%', "cs_check", '%', 'R');
+    b.add("cs_check", 'X', "cs_check", 'X', 'R');
+    b.add("cs_check", '1', "mm_go_left", '1', 'L');
+    b.add("cs_check", '0', "ss_go_cursor", '0', 'R');
+    b.add("cs_check", '%', "ss_go_cursor", '%', 'R');
+
+    // Compare the symbol field with the head cell the same way
+    b.pass("ss_go_cursor", 'R', "P");
+    b.add("ss_go_cursor", 'P', "ss_skip", 'P', 'R');
+    b.add("ss_skip", '1', "ss_skip", '1', 'R');
+    b.add("ss_skip", 'X', "ss_skip", 'X', 'R');
+    b.add("ss_skip", '0', "ss_scan", '0', 'R');
+    b.add("ss_scan", 'X', "ss_scan", 'X', 'R');
+    b.add("ss_scan", '1', "ss_go_head", 'X', 'R');
+    b.add("ss_scan", '0', "ss_check_go", '0', 'R');
+    b.pass("ss_go_head", 'R', "H");
+    b.add("ss_go_head", 'H', "ss_cell", 'H', 'R');
+    b.add("ss_cell", 'X', "ss_cell", 'X', 'R');
+    b.add("ss_cell", '1', "ss_back", 'X', 'L');
+    for (char end : string("0c#")) {
+        b.add("ss_cell", end, "mm_go_left", end, 'L');
+    }
+    b.pass("ss_back", 'L', "P");
+    b.add("ss_back", 'P', "ss_skip", 'P', 'R');
+    b.pass("ss_check_go", 'R', "H");
+    b.add("ss_check_go", 'H', "ss_check", 'H', 'R');
+    b.add("ss_check", 'X', "ss_check", 'X', 'R');
+    b.add("ss_check", '1', "mm_go_left", '1', 'L');
+    for (char end : string("0c#")) {
+        b.add("ss_check", end, "ex_clear_go", end, 'L');
+    }
+
+    // Mismatch: undo the marks and move the cursor to the next transition (past the next 00)
+    b.pass("mm_go_left", 'L', "<");
+    b.add("mm_go_left", '<', "mm_sweep", '<', 'R');
+    b.add("mm_sweep", 'X', "mm_sweep", '1', 'R');
+    b.add("mm_sweep", 'Z', "mm_sweep", '0', 'R');
+    b.pass("mm_sweep", 'R', "XZ#");
+    b.add("mm_sweep", '#', "mm_go_cursor", '#', 'L');
+    b.pass("mm_go_cursor", 'L', "P");
+    b.add("mm_go_cursor", 'P', "mm_next", '0', 'R');
+    b.add("mm_next", '1', "mm_next", '1', 'R');
+    b.add("mm_next", '0', "mm_next0", '0', 'R');
+    b.add("mm_next0", '1', "mm_next", '1', 'R');
+    b.add("mm_next0", '0', "cs_scan", 'P', 'R');
+
+    // Match: clear the head cell, then copy the write field into it
+    b.pass("ex_clear_go", 'L', "H");
+    b.add("ex_clear_go", 'H', "ex_clear", 'H', 'R');
+    for (char bit : string("01X")) {
+        b.add("ex_clear", bit, "ex_clear", '0', 'R');
+    }
+    b.add("ex_clear", 'c', "ex_w_go_cursor", 'c', 'L');
+    b.add("ex_clear", '#', "ex_w_go_cursor", '#', 'L');
+    b.pass("ex_w_go_cursor", 'L', "P");
+    b.add("ex_w_go_cursor", 'P', "ex_w_skip1", 'P', 'R');
+    const string write_skips[] = {"ex_w_skip1", "ex_w_skip2", "ex_w_skip3", "ex_w_scan"};
+    for (int i = 0; i < 3; i++) {
+        b.add(write_skips[i], '1', write_skips[i], '1', 'R');
+        b.add(write_skips[i], 'X', write_skips[i], 'X', 'R');
+        b.add(write_skips[i], '0', write_skips[i + 1], '0', 'R');
+    }
+    b.add("ex_w_scan", 'X', "ex_w_scan", 'X', 'R');
+    b.add("ex_w_scan", '1', "ex_w_go_head", 'X', 'R');
+    b.add("ex_w_scan", '0', "ex_s_go_cursor", '0', 'L');
+    b.pass("ex_w_go_head", 'R', "H");
+    b.add("ex_w_go_head", 'H', "ex_w_put", 'H', 'R');
+    b.add("ex_w_put", '1', "ex_w_put", '1', 'R');
+    b.add("ex_w_put", '0', "ex_w_back", '1', 'L');
+    b.pass("ex_w_back", 'L', "P");
+    b.add("ex_w_back", 'P', "ex_w_skip1", 'P', 'R');
+
+    // Clear STATE, then copy the next-state field into it
+    b.pass("ex_s_go_cursor", 'L', "P");
+    b.add("ex_s_go_cursor", 'P', "ex_s_go", 'P', 'L');
+    b.pass("ex_s_go", 'L', "<");
+    b.add("ex_s_go", '<', "ex_s0", '<', 'R');
+    b.add("ex_s0", '%', "ex_s_clear", '%', 'R');
+    for (char bit : string("01X")) {
+        b.add("ex_s_clear", bit, "ex_s_clear", '0', 'R');
+    }
+    b.add("ex_s_clear", '%', "ex_n_go_cursor", '%', 'R');
+    b.pass("ex_n_go_cursor", 'R', "P");
+    b.add("ex_n_go_cursor", 'P', "ex_n_skip1", 'P', 'R');
+    const string state_skips[] = {"ex_n_skip1", "ex_n_skip2", "ex_n_scan"};
+    for (int i = 0; i < 2; i++) {
+        b.add(state_skips[i], '1', state_skips[i], '1', 'R');
+        b.add(state_skips[i], 'X', state_skips[i], 'X', 'R');
+        b.add(state_skips[i], '0', state_skips[i + 1], '0', 'R');
+    }
+    b.add("ex_n_scan", 'X', "ex_n_scan", 'X', 'R');
+    b.add("ex_n_scan", '1', "ex_n_go_state", 'X', 'L');
+    b.add("ex_n_scan", '0', "ex_a_go_cursor", '0', 'L');
+    b.pass("ex_n_go_state", 'L', "<");
+    b.add("ex_n_go_state", '<', "ex_n0", '<', 'R');
+    b.add("ex_n0", '%', "ex_n_put", '%', 'R');
+    b.add("ex_n_put", '1', "ex_n_put", '1', 'R');
+    b.add("ex_n_put", '0', "ex_n_back", '1', 'R');
+    b.pass("ex_n_back", 'R', "P");
+    b.add("ex_n_back", 'P', "ex_n_skip1", 'P', 'R');
+
+    // Count the 1s of the action field: L, R, Y, N
+    b.pass("ex_a_go_cursor", 'L', "P");
+    b.add("ex_a_go_cursor", 'P', "ex_a_skip1", 'P', 'R');
+    const string action_skips[] = {"ex_a_skip1", "ex_a_skip2", "ex_a_skip3", "ex_a_skip4", "ex_a_count1"};
+    for (int i = 0; i < 4; i++) {
+        b.add(action_skips[i], '1', action_skips[i], '1', 'R');
+        b.add(action_skips[i], 'X', action_skips[i], 'X', 'R');
+        b.add(action_skips[i], '0', action_skips[i + 1], '0', 'R');
+    }
+    const string counts[] = {"ex_a_count1", "ex_a_count2", "ex_a_count3", "ex_a_count4", "ex_a_count5"};
+    for (int i = 0; i < 4; i++) {
+        b.add(counts[i], '1', counts[i + 1], '1', 'R');
+    }
+    for (char end : string("0%")) {
+        b.add("ex_a_count2", end, "mv_left", end, 'R');
+        b.add("ex_a_count3", end, "mv_right", end, 'R');
+        b.add("ex_a_count4", end, "halt", end, 'Y');
+        b.add("ex_a_count5", end, "halt", end, 'N');
+    }
+
+    // Move H to the previous or next cell separator
+    b.pass("mv_left", 'R', "H");
+    b.add("mv_left", 'H', "mv_left_cell", 'c', 'L');
+    for (char bit : string("01X")) {
+        b.add("mv_left_cell", bit, "mv_left_cell", bit, 'L');
+        b.add("mv_right_cell", bit, "mv_right_cell", bit, 'R');
+    }
+    b.add("mv_left_cell", 'c', "rs_go_left", 'H', 'L');
+    b.add("mv_left_cell", '%', "sh_pick", '%', 'R');
+    b.pass("mv_right", 'R', "H");
+    b.add("mv_right", 'H', "mv_right_cell", 'c', 'R');
+    b.add("mv_right_cell", 'c', "rs_go_left", 'H', 'L');
+    b.add("mv_right_cell", '#', "ap_go", 'H', 'L');
+
+    // Past the right end: append a copy of BLANK, one marked bit at a time
+    b.pass("ap_go", 'L', "<");
+    b.add("ap_go", '<', "ap0", '<', 'R');
+    b.add("ap0", '%', "ap_state", '%', 'R');
+    for (char bit : string("01X")) {
+        b.add("ap_state", bit, "ap_state", bit, 'R');
+    }
+    b.add("ap_state", '%', "ap_blank", '%', 'R');
+    b.add("ap_blank", 'X', "ap_blank", 'X', 'R');
+    b.add("ap_blank", 'Z', "ap_blank", 'Z', 'R');
+    b.add("ap_blank", '1', "ap_carry1", 'X', 'R');
+    b.add("ap_blank", '0', "ap_carry0", 'Z', 'R');
+    b.add("ap_blank", '%', "rs_go_left", '%', 'L');
+    b.pass("ap_carry1", 'R', "#");
+    b.add("ap_carry1", '#', "ap_go", '1', 'L');
+    b.pass("ap_carry0", 'R', "#");
+    b.add("ap_carry0", '#', "ap_go", '0', 'L');
+
+    // Past the left end: shift the cells right once per BLANK bit plus once for the separator
+    const string cell_symbols = "01ch";
+    for (char picked : cell_symbols) {
+        b.add("sh_pick", picked, string("sh_carry_") + picked, 'h', 'R');
+        for (char next : cell_symbols) {
+            b.add(string("sh_carry_") + picked, next, string("sh_carry_") + next, picked, 'R');
+        }
+        b.add(string("sh_carry_") + picked, '#', "lx_go", picked, 'L');
+    }
+    b.pass("lx_go", 'L', "<");
+    b.add("lx_go", '<', "lx0", '<', 'R');
+    b.add("lx0", '%', "lx_state", '%', 'R');
+    for (char bit : string("01X")) {
+        b.add("lx_state", bit, "lx_state", bit, 'R');
+    }
+    b.add("lx_state", '%', "lx_blank", '%', 'R');
+    b.add("lx_blank", 'X', "lx_blank", 'X', 'R');
+    b.add("lx_blank", 'Z', "lx_blank", 'Z', 'R');
+    b.add("lx_blank", '1', "lx_shift_go", 'X', 'R');
+    b.add("lx_blank", '0', "lx_shift_go", 'Z', 'R');
+    b.add("lx_blank", '%', "lf_unmark", '%', 'L');
+    b.pass("lx_shift_go", 'R', "%");
+    b.add("lx_shift_go", '%', "lx_shift_go2", '%', 'R');
+    b.pass("lx_shift_go2", 'R', "%");
+    b.add("lx_shift_go2", '%', "sh_pick", '%', 'R');
+    // Unmark BLANK, put H in the first hole and copy BLANK into the others
+    b.add("lf_unmark", 'X', "lf_unmark", '1', 'L');
+    b.add("lf_unmark", 'Z', "lf_unmark", '0', 'L');
+    b.add("lf_unmark", '%', "lf_head_go", '%', 'R');
+    b.pass("lf_head_go", 'R', "h");
+    b.add("lf_head_go", 'h', "lf_go", 'H', 'L');
+    b.pass("lf_go", 'L', "<");
+    b.add("lf_go", '<', "lf0", '<', 'R');
+    b.add("lf0", '%', "lf_state", '%', 'R');
+    for (char bit : string("01X")) {
+        b.add("lf_state", bit, "lf_state", bit, 'R');
+    }
+    b.add("lf_state", '%', "lf_blank", '%', 'R');
+    b.add("lf_blank", 'X', "lf_blank", 'X', 'R');
+    b.add("lf_blank", 'Z', "lf_blank", 'Z', 'R');
+    b.add("lf_blank", '1', "lf_carry1", 'X', 'R');
+    b.add("lf_blank", '0', "lf_carry0", 'Z', 'R');
+    b.add("lf_blank", '%', "rs_go_left", '%', 'L');
+    b.pass("lf_carry1", 'R', "h");
+    b.add("lf_carry1", 'h', "lf_go", '1', 'L');
+    b.pass("lf_carry0", 'R', "h");
+    b.add("lf_carry0", 'h', "lf_go", '0', 'L');
+
+    // Step done: undo the marks and put the cursor back on the first transition
+    b.pass("rs_go_left", 'L', "<");
+    b.add("rs_go_left", '<', "rs_sweep", '<', 'R');
+    b.add("rs_sweep", 'X', "rs_sweep", '1', 'R');
+    b.add("rs_sweep", 'Z', "rs_sweep", '0', 'R');
+    b.pass("rs_sweep", 'R', "XZ#");
+    b.add("rs_sweep", '#', "rs_go_cursor", '#', 'L');
+    b.pass("rs_go_cursor", 'L', "P");
+    b.add("rs_go_cursor", 'P', "rs_go_code", '0', 'L');
+    b.pass("rs_go_code", 'L', "%");
+    b.add("rs_go_code", '%', "rs_first", '%', 'R');
+    b.add("rs_first", '0', "cs_scan", 'P', 'R');
+
+    return b.definition("start");
+}
+
+// This function writes the UTM input tape (without the UTM's left mark) for running tm on tape from head_pos
+string utm_encode_input(TuringMachine &tm, const string &tape, long long head_pos) {
+    set<string> states = tm.get_states();
+    set<char> symbols = tm.get_tape_symbols();
+    size_t n_states = states.size(), width = symbols.size();
+    auto unary_field = [](size_t ones, size_t width) {
+        return string(ones, '1') + string(width - ones, '0');
+    };
+    auto symbol_number = [&](char symbol) {
+        auto it = symbols.find(symbol);
+        return it == symbols.end() ? 0 : size_t(distance(symbols.begin(), it)) + 1;
+    };
+
+    size_t initial = distance(states.begin(), states.find(tm.get_initial_state())) + 1;
+    string input = "%" + unary_field(initial, n_states) + "%" + unary_field(symbol_number('#'), width) + "%P" + tm.get_machine_code() + "%";
+    long long n_cells = max((long long)tape.size(), head_pos + 1);
+    for (long long pos = 0; pos < n_cells; pos++) {
+        input += (pos == head_pos) ? 'H' : 'c';
+        input += unary_field(symbol_number(pos < (long long)tape.size() ? tape[pos] : '#'), width);
+    }
+    return input;
+}
+
+/* This function reads M's tape and head position back from a halted UTM tape.
+
+    The first decoded cell is the leftmost cell M visited. Cells holding a symbol
+    outside M's tape alphabet decode as '?'.
+*/
+bool utm_decode_tape(TuringMachine &tm, const string &utm_tape, string &tape, long long &head_pos) {
+    size_t cells = 0;
+    for (int marks = 0; marks < 4; marks++) {
+        cells = utm_tape.find('%', cells);
+        if (cells == string::npos) {
+            return false;
+        }
+        cells++;
+    }
+    set<char> symbols = tm.get_tape_symbols();
+    string symbol_of = "?" + string(symbols.begin(), symbols.end());
+
+    tape.clear();
+    head_pos = -1;
+    for (size_t i = cells; i < utm_tape.size() && (utm_tape[i] == 'c' || utm_tape[i] == 'H'); ) {
+        if (utm_tape[i] == 'H') {
+            head_pos = tape.size();
+        }
+        size_t ones = 0;
+        for (i++; i < utm_tape.size() && (utm_tape[i] == '0' || utm_tape[i] == '1'); i++) {
+            ones += (utm_tape[i] == '1');
+        }
+        tape += (ones < symbol_of.size()) ? symbol_of[ones] : '?';
+    }
+    return head_pos >= 0;
+}
+
+/* Renders cells and the head for comparison: symbols outside the alphabet become '?'
+    and blanks at either end are dropped, with the head kept relative to the first
+    remaining cell. The UTM tape starts at the leftmost cell M visited, which need
+    not be cell 0, so only this translation-free form is compared.
+*/
+static pair<string, long long> normalize_cells(const string &cells, long long head_pos, const set<char> &symbols) {
+    string result = cells;
+    for (char &symbol : result) {
+        if (symbols.find(symbol) == symbols.end()) {
+            symbol = '?';
+        }
+    }
+    char blank = symbols.count('#') ? '#' : '?';
+    while (!result.empty() && result.back() == blank) {
+        result.pop_back();
+    }
+    size_t first = result.find_first_not_of(blank);
+    if (first == string::npos) {
+        return make_pair(string(), 0LL);
+    }
+    return make_pair(result.substr(first), head_pos - (long long)first);
+}
+
+struct UtmComparison {
+    RunResult direct, universal;
+    bool agree;
+};
+
+class UniversalRunner {
+
+    private:
+        TuringMachine &tm;
+        CompiledMachine cm, utm;
+        RunOptions options;
+        Tape direct_cells, utm_cells;
+
+    public:
+        UniversalRunner(TuringMachine &tm, RunOptions options) : tm(tm), options(options) {
+            tm.compile(this->cm);
+            TuringMachine universal;
+            istringstream definition(build_utm_definition());
+            universal.load_TM_specs(definition, "utm");
+            universal.compile(this->utm);
+            this->options.trace = TRACE_NONE;
+        }
+
+        uint32_t utm_states() const {
+            return this->utm.n_states;
+        }
+
+        // Runs tm on tape (with the left mark) directly and under the UTM, and compares outcome, tape and head
+        UtmComparison run(const string &tape, long long head_pos) {
+            UtmComparison result;
+            this->cm.encode_tape(tape, this->direct_cells);
+            result.direct = run_machine(this->cm, this->direct_cells, head_pos, this->options);
+
+            // A machine that halted halts under the UTM too, only much later, so the step limit is
+            // lifted for it; the time limit still applies
+            RunOptions utm_options = this->options;
+            if (result.direct.outcome != OUT_TIMEOUT && result.direct.outcome != OUT_LOOP) {
+                utm_options.max_steps = 0;
+            }
+            string utm_tape = "<" + utm_encode_input(this->tm, tape, head_pos);
+            this->utm.encode_tape(utm_tape, this->utm_cells);
+            result.universal = run_machine(this->utm, this->utm_cells, 1, utm_options);
+
+            result.agree = false;
+            Outcome direct = result.direct.outcome, universal = result.universal.outcome;
+            if (direct == OUT_TIMEOUT || universal == OUT_TIMEOUT || direct == OUT_LOOP || universal == OUT_LOOP) {
+                // Only runs that halt on both sides can be compared
+                result.agree = (direct == OUT_TIMEOUT || direct == OUT_LOOP) && (universal == OUT_TIMEOUT || universal == OUT_LOOP);
+                return result;
+            }
+            if (direct != universal) {
+                return result;
+            }
+
+            pair<long long, long long> written = this->utm_cells.nonblank_range();
+            string decoded;
+            long long decoded_head;
+            if (!utm_decode_tape(this->tm, this->utm.decode_tape(this->utm_cells, 0, written.second + 1), decoded, decoded_head)) {
+                return result;
+            }
+            long long direct_head = result.direct.head_pos;
+            long long from = min(0LL, direct_head), to = max((long long)tape.size() - 1, direct_head);
+            pair<long long, long long> direct_written = this->direct_cells.nonblank_range();
+            if (direct_written.first <= direct_written.second) {
+                from = min(from, direct_written.first);
+                to = max(to, direct_written.second);
+            }
+            set<char> symbols = this->tm.get_tape_symbols();
+            result.agree = normalize_cells(decoded, decoded_head, symbols) ==
+                           normalize_cells(this->cm.decode_tape(this->direct_cells, from, to + 1), direct_head - from, symbols);
+            return result;
+        }
+};
+
+/* Runs each input tape on the machine directly and under the UTM.
+
+    Tapes are read like batch mode. One line is printed per tape:
+    <tape> <outcome> <steps> <UTM outcome> <UTM steps> <UTM steps per step> <agree|DISAGREE>
+*/
+bool run_universal(TuringMachine &tm, istream &in, ostream &out, const RunOptions &options) {
+    CompiledMachine cm;
+    if (!tm.compile(cm)) {
+        return false;
+    }
+    UniversalRunner runner(tm, options);
+    string line, tape;
+    TapeJob job;
+    long long n_tapes = 0, n_disagree = 0;
+    while (getline(in, line)) {
+        if (!read_tape_job(cm, line, tape, job)) {
+            out << tape << '\t' << outcome_name(OUT_INVALID_TAPE) << '\n';
+            continue;
+        }
+        UtmComparison result = runner.run(job.tape, job.head_pos);
+        n_tapes++;
+        n_disagree += !result.agree;
+        out << tape << '\t' << outcome_name(result.direct.outcome) << '\t' << result.direct.steps << '\t'
+            << outcome_name(result.universal.outcome) << '\t' << result.universal.steps << '\t'
+            << double(result.universal.steps) / max(1LL, result.direct.steps) << '\t'
+            << (result.agree ? "agree" : "DISAGREE") << '\n';
+    }
+    out.flush();
+    cerr << n_tapes << " tapes, " << n_disagree << " disagreements" << endl;
+    return n_disagree == 0;
+}
+
+/* This function reports UTM overhead as the simulated machine grows.
+
+    Machine n has n states that toggle bits while walking right, state i moving to
+    state i+1 mod n, and accepts at the first blank. It runs on the same 64-bit input
+    for every n, so only the size of the machine code changes.
+*/
+void benchmark_universal(const RunOptions &options) {
+    const string input = "<0110100110010110011010011001011001101001100101100110100110010110";
+    cout << bold(underline("UTM overhead:")) << " " << input.size() - 1 << "-cell input, "
+         << (options.engine == ENGINE_ACCELERATED ? "accel" : "naive") << " engine" << endl;
+    for (int n = 1; n <= 32; n *= 2) {
+        ostringstream definition;
+        definition << "states:";
+        for (int i = 0; i < n; i++) {
+            definition << " q" << i;
+        }
+        definition << "\ninput: 0 1\ntape: 0 1 #\ninitial: q0\n";
+        for (int i = 0; i < n; i++) {
+            string next = "q" + to_string((i + 1) % n);
+            definition << "(q" << i << ",0) -> (" << next << ",1,R)\n";
+            definition << "(q" << i << ",1) -> (" << next << ",0,R)\n";
+            definition << "(q" << i << ",#) -> (q" << i << ",#,Y)\n";
+        }
+        TuringMachine tm;
+        istringstream text(definition.str());
+        tm.load_TM_specs(text, "bench");
+        UniversalRunner runner(tm, options);
+
+        auto start = chrono::steady_clock::now();
+        UtmComparison result = runner.run(input, 1);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << bold(to_string(n) + " states: ") << "code " << tm.get_machine_code().size() << " bits, "
+             << result.direct.steps << " steps, UTM " << result.universal.steps << " steps, "
+             << double(result.universal.steps) / max(1LL, result.direct.steps) << " per step, "
+             << seconds << " s" << (result.agree ? "" : red(" DISAGREE")) << endl;
+    }
+}
+
+/*****************************************************************/
+/********************** MULTI-TAPE MACHINES **********************/
+/*****************************************************************/
+/* A perfect hash over a fixed set of 64-bit keys (hash and displace).
+
+    Keys are split into buckets by one hash, and buckets are placed largest first:
+    each tries displacements d = 0, 1, ... until all of its keys land on free slots
+    under slot = mix(key, d) % n_slots. A lookup reads one displacement and one slot,
+    and compares the stored key to turn away keys outside the set.
+*/
+class PerfectHash {
+
+    private:
+        vector<uint32_t> displacements;
+        vector<uint64_t> slot_keys;
+        vector<uint32_t> slot_values;
+
+        static uint64_t mix(uint64_t key, uint64_t seed) {
+            uint64_t x = key ^ (seed * 0x9E3779B97F4A7C15ULL);
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ULL;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBULL;
+            return x ^ (x >> 31);
+        }
+
+    public:
+        static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+        void build(const vector<uint64_t> &keys, const vector<uint32_t> &values) {
+            size_t n_buckets = max<size_t>(1, keys.size() / 4);
+            size_t n_slots = keys.size() + keys.size() / 8 + 1;
+            vector<vector<size_t>> buckets(n_buckets);
+            for (size_t i = 0; i < keys.size(); i++) {
+                buckets[mix(keys[i], 0) % n_buckets].push_back(i);
+            }
+            vector<size_t> order(n_buckets);
+            for (size_t b = 0; b < n_buckets; b++) {
+                order[b] = b;
+            }
+            sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+            this->displacements.assign(n_buckets, 0);
+            this->slot_keys.assign(n_slots, 0);
+            this->slot_values.assign(n_slots, NOT_FOUND);
+            vector<bool> used(n_slots, false);
+            vector<size_t> slots;
+            for (size_t b : order) {
+                for (uint32_t d = 1; !buckets[b].empty(); d++) {
+                    slots.clear();
+                    for (size_t i : buckets[b]) {
+                        size_t slot = mix(keys[i], d) % n_slots;
+                        if (used[slot] || find(slots.begin(), slots.end(), slot) != slots.end()) {
+                            break;
+                        }
+                        slots.push_back(slot);
+                    }
+                    if (slots.size() == buckets[b].size()) {
+                        this->displacements[b] = d;
+                        for (size_t j = 0; j < slots.size(); j++) {
+                            used[slots[j]] = true;
+                            this->slot_keys[slots[j]] = keys[buckets[b][j]];
+                            this->slot_values[slots[j]] = values[buckets[b][j]];
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        uint32_t find_value(uint64_t key) const {
+            if (this->slot_keys.empty()) {
+                return NOT_FOUND;
+            }
+            uint32_t d = this->displacements[mix(key, 0) % this->displacements.size()];
+            size_t slot = mix(key, d) % this->slot_keys.size();
+            return (this->slot_keys[slot] == key) ? this->slot_values[slot] : NOT_FOUND;
+        }
+};
+
+/* A machine with k tapes and k heads moving in lockstep.
+
+    Definition file format, as for one tape plus the number of tapes; each transition
+    reads one symbol per tape and gives one write symbol and one move (L, R or S to
+    stay) per tape, or a single Y or N to halt after writing:
+    tapes: 2
+    states: q0 q1
+    input: 0 1
+    tape: 0 1 # <
+    initial: q0
+    (q0,1,#) -> (q0,1,1,R,R)
+    (q0,#,#) -> (q1,#,#,S,L)
+    (q1,#,1) -> (q1,#,1,Y)
+
+    The input goes on tape 1 after its left mark; every other tape starts as a left
+    mark followed by blanks, with its head on cell 1. Symbols are numbered with the
+    blank '#' first. Transitions are looked up by (state, symbol 1..k) in a dense
+    table of n_states * |Γ|^k entries when that fits in MAX_DENSE_ENTRIES, and in a
+    perfect hash of the defined keys otherwise.
+*/
+struct MultiRunResult {
+    Outcome outcome;
+    long long steps;
+    vector<long long> heads;
+    uint32_t state;
+};
+
+class MultiTapeMachine {
+
+    public:
+        static constexpr size_t MAX_DENSE_ENTRIES = 1 << 22;
+        static constexpr int MAX_TAPES = 6;
+        static constexpr uint8_t MOVE_L = 0, MOVE_R = 1, MOVE_S = 2;
+
+    private:
+        int k = 0;
+        vector<string> state_names;
+        map<string, uint32_t> state_ids;
+        uint32_t initial_state = 0;
+        set<char> input_symbols;
+        vector<char> symbols;                // symbol ID -> character, '#' first
+        array<int16_t, 256> symbol_ids;
+
+        // Transition t: next_state[t], halt[t] (ACT_NONE, ACT_Y or ACT_N), writes/moves[t * k + i]
+        vector<uint64_t> keys;
+        vector<uint32_t> next_state;
+        vector<uint8_t> halt, writes, moves;
+
+        bool dense = true;
+        vector<uint32_t> dense_table;
+        PerfectHash hashed;
+
+        uint64_t dense_index(uint32_t state, const uint8_t *read) const {
+            uint64_t index = state;
+            for (int i = this->k - 1; i >= 0; i--) {
+                index = index * this->symbols.size() + read[i];
+            }
+            return index;
+        }
+
+        uint64_t hash_key(uint32_t state, const uint8_t *read) const {
+            uint64_t key = state;
+            for (int i = 0; i < this->k; i++) {
+                key = (key << 8) | read[i];
+            }
+            return key;
+        }
+
+        static vector<string> split_fields(const string &text) {
+            vector<string> fields;
+            string field;
+            istringstream in(text);
+            while (getline(in, field, ',')) {
+                fields.push_back(trim_copy(field));
+            }
+            return fields;
+        }
+
+    public:
+        int tape_count() const {
+            return this->k;
+        }
+
+        size_t symbol_count() const {
+            return this->symbols.size();
+        }
+
+        bool uses_dense_table() const {
+            return this->dense;
+        }
+
+        // Loads a k-tape definition; errors are reported to stderr with their line number
+        bool load_specs(istream &file, const string &source) {
+            bool ok = true;
+            auto report = [&](int line_no, string message) {
+                cerr << red("Error: " + source + ":" + to_string(line_no) + ": " + message) << endl;
+                ok = false;
+            };
+
+            set<char> tape_symbols;
+            string initial;
+            vector<pair<int, string>> transition_lines;
+            string line;
+            int line_no = 0;
+            while (getline(file, line)) {
+                line_no++;
+                trim(line);
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+                if (line[0] == '(') {
+                    transition_lines.emplace_back(line_no, line);
+                    continue;
+                }
+                size_t colon = line.find(':');
+                if (colon == string::npos) {
+                    report(line_no, "Expected 'key: values' or a transition.");
+                    continue;
+                }
+                string key = trim_copy(line.substr(0, colon));
+                istringstream values(line.substr(colon + 1));
+                string value;
+                if (key == "tapes") {
+                    values >> this->k;
+                    if (this->k < 1 || this->k > MAX_TAPES) {
+                        report(line_no, "The number of tapes must be between 1 and " + to_string(MAX_TAPES) + ".");
+                    }
+                } else if (key == "states") {
+                    while (values >> value) {
+                        if (!this->state_ids.emplace(value, this->state_names.size()).second) {
+                            report(line_no, "Invalid state " + value + ".");
+                            continue;
+                        }
+                        this->state_names.push_back(value);
+                    }
+                } else if (key == "input" || key == "tape") {
+                    set<char> &symbol_set = (key == "input") ? this->input_symbols : tape_symbols;
+                    while (values >> value) {
+                        if (value.size() != 1 || !symbol_set.insert(value[0]).second) {
+                            report(line_no, "Invalid symbol " + value + ".");
+                        }
+                    }
+                } else if (key == "initial") {
+                    values >> initial;
+                } else {
+                    report(line_no, "Unknown key " + key + ".");
+                }
+            }
+            if (this->k == 0) {
+                report(line_no, "No number of tapes defined.");
+                return false;
+            }
+            if (this->state_names.empty()) {
+                report(line_no, "No states defined.");
+            }
+            if (this->state_ids.find(initial) == this->state_ids.end()) {
+                report(line_no, "Unrecognized initial state " + initial + ".");
+            } else {
+                this->initial_state = this->state_ids[initial];
+            }
+            for (char symbol : this->input_symbols) {
+                if (tape_symbols.find(symbol) == tape_symbols.end()) {
+                    report(line_no, "Input symbols must be a subset of tape symbols.");
+                    break;
+                }
+            }
+
+            this->symbol_ids.fill(-1);
+            set<char> alphabet = tape_symbols;
+            alphabet.insert('<');
+            alphabet.erase('#');
+            this->symbols.assign(1, '#');
+            this->symbols.insert(this->symbols.end(), alphabet.begin(), alphabet.end());
+            for (size_t id = 0; id < this->symbols.size(); id++) {
+                this->symbol_ids[(unsigned char)this->symbols[id]] = int16_t(id);
+            }
+
+            auto symbol_id = [&](const string &field) {
+                return (field.size() == 1 && tape_symbols.count(field[0])) ? this->symbol_ids[(unsigned char)field[0]] : -1;
+            };
+            set<uint64_t> seen;
+            vector<uint8_t> read(this->k);
+            for (auto &entry : transition_lines) {
+                const string &text = entry.second;
+                size_t close = text.find(')'), arrow = text.find("->");
+                size_t open2 = text.find('(', arrow), close2 = text.rfind(')');
+                if (close == string::npos || arrow == string::npos || open2 == string::npos || close2 < open2) {
+                    report(entry.first, "Invalid transition.");
+                    continue;
+                }
+                vector<string> lhs = split_fields(text.substr(1, close - 1));
+                vector<string> rhs = split_fields(text.substr(open2 + 1, close2 - open2 - 1));
+                bool halting = rhs.size() == size_t(this->k) + 2 && (rhs.back() == "Y" || rhs.back() == "N");
+                if (lhs.size() != size_t(this->k) + 1 || (rhs.size() != size_t(2 * this->k) + 1 && !halting)) {
+                    report(entry.first, "Expected " + to_string(this->k) + " symbols to read, write and move.");
+                    continue;
+                }
+                if (!this->state_ids.count(lhs[0]) || !this->state_ids.count(rhs[0])) {
+                    report(entry.first, "Unrecognized state.");
+                    continue;
+                }
+                bool valid = true;
+                for (int i = 0; i < this->k; i++) {
+                    int16_t r = symbol_id(lhs[i + 1]), w = symbol_id(rhs[i + 1]);
+                    valid = valid && r >= 0 && w >= 0;
+                    read[i] = uint8_t(max<int16_t>(r, 0));
+                    this->writes.push_back(uint8_t(max<int16_t>(w, 0)));
+                    string move = halting ? "S" : rhs[this->k + 1 + i];
+                    valid = valid && (move == "L" || move == "R" || move == "S");
+                    this->moves.push_back(move == "L" ? MOVE_L : move == "R" ? MOVE_R : MOVE_S);
+                }
+                string last = rhs.back();
+                uint64_t key = hash_key(this->state_ids[lhs[0]], read.data());
+                if (!valid || !seen.insert(key).second) {
+                    report(entry.first, valid ? "Duplicate transition." : "Invalid symbol or move.");
+                    this->writes.resize(this->writes.size() - this->k);
+                    this->moves.resize(this->moves.size() - this->k);
+                    continue;
+                }
+                this->keys.push_back(key);
+                this->next_state.push_back(this->state_ids[rhs[0]]);
+                this->halt.push_back(!halting ? ACT_NONE : (last == "Y") ? ACT_Y : ACT_N);
+            }
+            if (ok) {
+                compile_lookup();
+            }
+            return ok;
+        }
+
+        // Builds the dense table when n_states * |Γ|^k is small enough, else the perfect hash
+        void compile_lookup() {
+            double entries = this->state_names.size() * pow(double(this->symbols.size()), this->k);
+            this->dense = entries <= MAX_DENSE_ENTRIES;
+            vector<uint8_t> read(this->k);
+            if (this->dense) {
+                this->dense_table.assign(size_t(entries), PerfectHash::NOT_FOUND);
+            }
+            vector<uint32_t> values;
+            for (uint32_t t = 0; t < this->keys.size(); t++) {
+                for (int i = 0; i < this->k; i++) {
+                    read[i] = uint8_t(this->keys[t] >> (8 * (this->k - 1 - i)));
+                }
+                uint32_t state = uint32_t(this->keys[t] >> (8 * this->k));
+                if (this->dense) {
+                    this->dense_table[dense_index(state, read.data())] = t;
+                }
+                values.push_back(t);
+            }
+            if (!this->dense) {
+                this->hashed.build(this->keys, values);
+            }
+        }
+
+        // Returns the transition for state reading read[0..k-1], or PerfectHash::NOT_FOUND
+        uint32_t lookup(uint32_t state, const uint8_t *read) const {
+            if (this->dense) {
+                return this->dense_table[dense_index(state, read)];
+            }
+            return this->hashed.find_value(hash_key(state, read));
+        }
+
+        bool check_valid_input(const string &tape) const {
+            for (char c : tape) {
+                if (!this->input_symbols.count(c)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Fills the k tapes for an input tape given with its left mark and returns the initial head positions
+        vector<long long> encode_tapes(const string &tape, long long head_pos, vector<Tape> &tapes) const {
+            tapes.resize(this->k);
+            vector<long long> heads(this->k, 1);
+            heads[0] = head_pos;
+            for (int i = 0; i < this->k; i++) {
+                tapes[i].reset(0);
+                tapes[i].set(0, uint8_t(this->symbol_ids[(unsigned char)'<']));
+            }
+            for (size_t i = 0; i < tape.size(); i++) {
+                tapes[0].set(i, uint8_t(this->symbol_ids[(unsigned char)tape[i]]));
+            }
+            return heads;
+        }
+
+        string decode_tape(const Tape &tape, long long from, long long to) const {
+            string text;
+            for (long long i = from; i < to; i++) {
+                text += this->symbols[tape.get(i)];
+            }
+            return text;
+        }
+
+        // Runs the machine on tapes filled by encode_tapes until it halts or reaches options.max_steps
+        MultiRunResult run(vector<Tape> &tapes, vector<long long> heads, const RunOptions &options) const {
+            long long max_steps = options.max_steps > 0 ? options.max_steps : LLONG_MAX;
+            vector<uint8_t> read(this->k);
+            uint32_t state = this->initial_state;
+            long long steps = 0;
+            while (true) {
+                if (steps == max_steps) {
+                    return {OUT_TIMEOUT, steps, heads, state};
+                }
+                for (int i = 0; i < this->k; i++) {
+                    read[i] = tapes[i].page_at(Tape::page_start_of(heads[i]))[heads[i] - Tape::page_start_of(heads[i])];
+                }
+                uint32_t t = lookup(state, read.data());
+                if (t == PerfectHash::NOT_FOUND) {
+                    return {OUT_NO_TRANSITION, steps, heads, state};
+                }
+                steps++;
+                for (int i = 0; i < this->k; i++) {
+                    tapes[i].set(heads[i], this->writes[t * this->k + i]);
+                    uint8_t move = this->moves[t * this->k + i];
+                    heads[i] += (move == MOVE_R) - (move == MOVE_L);
+                }
+                state = this->next_state[t];
+                if (this->halt[t] != ACT_NONE) {
+                    return {this->halt[t] == ACT_Y ? OUT_ACCEPT : OUT_REJECT, steps, heads, state};
+                }
+            }
+        }
+
+        /* This function builds the standard single-tape simulation of the machine.
+
+            Cell j of the single tape holds the track tuple (symbol, head here?) for cell j
+            of every tape, numbered so the all-blank tuple is the blank (ID 0); this needs
+            (2|Γ|)^k <= 256. Each simulated step starts one cell left of the leftmost head
+            marker, sweeps right until every head has been seen, which determines the
+            transition, then sweeps back left writing the new symbols and moving the
+            markers (a marker moving right takes a one-cell detour back), and finally
+            steps back to one cell left of the new leftmost marker. The simulation's
+            states are generated from the reachable (phase, transition, heads done,
+            markers pending) combinations. Returns false if the tuples do not fit in a
+            symbol or the states do not fit in MAX_STATES.
+        */
+        bool single_tape_simulation(CompiledMachine &cm) const {
+            const uint32_t base = 2 * this->symbols.size();
+            uint64_t n_tuples = 1;
+            for (int i = 0; i < this->k; i++) {
+                n_tuples *= base;
+            }
+            if (n_tuples > 256) {
+                return false;
+            }
+            const uint32_t all_heads = (1u << this->k) - 1;
+
+            // (phase, state or transition, seen symbols or heads done, markers pending left, markers pending right)
+            enum Phase { GATHER, UPDATE, DETOUR, BACK, FINISH, SCAN };
+            typedef tuple<int, uint32_t, uint32_t, uint32_t, uint32_t> SimState;
+            map<SimState, uint32_t> ids;
+            vector<SimState> pending;
+            auto id_of = [&](SimState s) {
+                auto it = ids.find(s);
+                if (it != ids.end()) {
+                    return it->second;
+                }
+                uint32_t id = ids.size();
+                ids.emplace(s, id);
+                pending.push_back(s);
+                return id;
+            };
+
+            auto track_symbol = [&](uint32_t tuple, int i) { return (tuple / this->tuple_weight(i)) / 2 % this->symbols.size(); };
+            auto has_marker = [&](uint32_t tuple, int i) { return (tuple / this->tuple_weight(i)) % 2 == 1; };
+            auto with_marker = [&](uint32_t tuple, int i) { return has_marker(tuple, i) ? tuple : tuple + this->tuple_weight(i); };
+            auto with_symbol = [&](uint32_t tuple, int i, uint32_t symbol) {
+                return tuple - track_symbol(tuple, i) * 2 * this->tuple_weight(i) + symbol * 2 * this->tuple_weight(i);
+            };
+            auto add_markers = [&](uint32_t tuple, uint32_t heads) {
+                for (int i = 0; i < this->k; i++) {
+                    if (heads & (1u << i)) {
+                        tuple = with_marker(tuple, i);
+                    }
+                }
+                return tuple;
+            };
+
+            // Writes and moves the heads of transition t marked on this cell and not done yet
+            auto update_cell = [&](uint32_t tuple, uint32_t t, uint32_t done, uint32_t pending_left) {
+                uint32_t result = add_markers(tuple, pending_left);
+                uint32_t new_left = 0, new_right = 0;
+                for (int i = 0; i < this->k; i++) {
+                    if (!has_marker(tuple, i) || (done & (1u << i))) {
+                        continue;
+                    }
+                    result = with_symbol(result - this->tuple_weight(i), i, this->writes[t * this->k + i]);
+                    uint8_t move = this->moves[t * this->k + i];
+                    if (move == MOVE_S) {
+                        result = with_marker(result, i);
+                    } else if (move == MOVE_L) {
+                        new_left |= 1u << i;
+                    } else {
+                        new_right |= 1u << i;
+                    }
+                    done |= 1u << i;
+                }
+                SimState next = (new_right != 0) ? SimState(DETOUR, t, done, new_left, new_right)
+                              : (done == all_heads) ? SimState(FINISH, t, 0, new_left, 0)
+                              : SimState(UPDATE, t, done, new_left, 0);
+                return pack_transition(id_of(next), uint8_t(result), (new_right != 0) ? ACT_R : ACT_L);
+            };
+
+            vector<vector<uint32_t>> rows;
+            id_of(SimState(GATHER, this->initial_state, 0, 0, 0));
+            for (size_t next = 0; next < pending.size(); next++) {
+                if (pending.size() > MAX_STATES) {
+                    return false;
+                }
+                SimState s = pending[next];
+                int phase = get<0>(s);
+                uint32_t a = get<1>(s), b = get<2>(s), left = get<3>(s), right = get<4>(s);
+                vector<uint32_t> row(n_tuples);
+                for (uint32_t x = 0; x < n_tuples; x++) {
+                    uint32_t entry = pack_transition(0, 0, ACT_NONE);
+                    if (phase == GATHER) {
+                        // b holds symbol + 1 for every head seen so far, in base |Γ| + 1
+                        uint32_t seen = b, weight = 1, all_seen = 1;
+                        vector<uint8_t> read(this->k);
+                        for (int i = 0; i < this->k; i++) {
+                            uint32_t digit = seen / weight % (this->symbols.size() + 1);
+                            if (digit == 0 && has_marker(x, i)) {
+                                digit = track_symbol(x, i) + 1;
+                                seen += digit * weight;
+                            }
+                            all_seen &= (digit != 0);
+                            read[i] = uint8_t(digit - (digit != 0));
+                            weight *= this->symbols.size() + 1;
+                        }
+                        if (!all_seen) {
+                            entry = pack_transition(id_of(SimState(GATHER, a, seen, 0, 0)), uint8_t(x), ACT_R);
+                        } else {
+                            uint32_t t = lookup(a, read.data());
+                            if (t != PerfectHash::NOT_FOUND) {
+                                entry = update_cell(x, t, 0, 0);
+                            }
+                        }
+                    } else if (phase == UPDATE) {
+                        entry = update_cell(x, a, b, left);
+                    } else if (phase == DETOUR) {
+                        entry = pack_transition(id_of(SimState(BACK, a, b, left, 0)), uint8_t(add_markers(x, right)), ACT_L);
+                    } else if (phase == BACK) {
+                        SimState after = (b == all_heads) ? SimState(FINISH, a, 0, left, 0) : SimState(UPDATE, a, b, left, 0);
+                        entry = pack_transition(id_of(after), uint8_t(x), ACT_L);
+                    } else if (phase == FINISH) {
+                        uint32_t q = this->next_state[a];
+                        if (this->halt[a] != ACT_NONE) {
+                            entry = pack_transition(uint32_t(next), uint8_t(x), this->halt[a]);
+                        } else if (left != 0) {
+                            entry = pack_transition(id_of(SimState(GATHER, q, 0, 0, 0)), uint8_t(add_markers(x, left)), ACT_L);
+                        } else {
+                            entry = pack_transition(id_of(SimState(SCAN, q, 0, 0, 0)), uint8_t(x), ACT_R);
+                        }
+                    } else {
+                        bool any_marker = false;
+                        for (int i = 0; i < this->k; i++) {
+                            any_marker = any_marker || has_marker(x, i);
+                        }
+                        SimState after = any_marker ? SimState(GATHER, a, 0, 0, 0) : SimState(SCAN, a, 0, 0, 0);
+                        entry = pack_transition(id_of(after), uint8_t(x), any_marker ? ACT_L : ACT_R);
+                    }
+                    row[x] = entry;
+                }
+                rows.push_back(row);
+            }
+
+            cm = CompiledMachine();
+            cm.n_states = rows.size();
+            cm.n_symbols = n_tuples;
+            cm.initial_state = 0;
+            cm.blank = 0;
+            cm.symbol_ids.fill(-1);
+            const char *phase_names[] = {"gather", "update", "detour", "back", "finish", "scan"};
+            for (const SimState &s : pending) {
+                cm.state_names.push_back(string(phase_names[get<0>(s)]) + "_" + to_string(get<1>(s)) + "_" + to_string(get<2>(s)) +
+                                         "_" + to_string(get<3>(s)) + "_" + to_string(get<4>(s)));
+            }
+            for (uint32_t x = 0; x < n_tuples; x++) {
+                cm.symbols.push_back(char(x));
+            }
+            uint32_t *table = cm.allocate_table(pack_transition(0, 0, ACT_NONE));
+            for (size_t s = 0; s < rows.size(); s++) {
+                copy(rows[s].begin(), rows[s].end(), table + s * n_tuples);
+            }
+            return true;
+        }
+
+        // Weight of tape i's (symbol, marker) digit in a track tuple
+        uint32_t tuple_weight(int i) const {
+            uint32_t weight = 1;
+            for (int j = 0; j < i; j++) {
+                weight *= 2 * this->symbols.size();
+            }
+            return weight;
+        }
+};
+
+/* Runs each input tape on a k-tape machine and, with compare, on its single-tape simulation.
+
+    Tapes are read like batch mode. One line is printed per tape:
+    <tape> <outcome> <steps> <head 1> ... <head k>
+    and with compare:
+    <tape> <outcome> <steps> <single-tape outcome> <single-tape steps> <ratio> <agree|DISAGREE>
+    where agree means the outcomes, every tape and every head position match.
+*/
+bool run_multitape(const MultiTapeMachine &machine, istream &in, ostream &out, const RunOptions &options, bool compare) {
+    CompiledMachine single;
+    if (compare && !machine.single_tape_simulation(single)) {
+        cerr << red("Error: The single-tape simulation needs more than 256 track symbols ((2|Γ|)^k) or more than " +
+                    to_string(MAX_STATES) + " states") << endl;
+        return false;
+    }
+    RunOptions single_options = options;
+    single_options.trace = TRACE_NONE;
+
+    const int k = machine.tape_count();
+    const uint32_t n_symbols = machine.symbol_count();
+    vector<Tape> tapes;
+    Tape single_tape;
+    string line, tape;
+    long long n_disagree = 0;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        long long head_pos = 1;
+        tape.clear();
+        fields >> tape >> head_pos;
+        if (!machine.check_valid_input(tape) || head_pos < 0) {
+            out << tape << '\t' << outcome_name(OUT_INVALID_TAPE) << '\n';
+            continue;
+        }
+        vector<long long> heads = machine.encode_tapes("<" + tape, head_pos, tapes);
+        MultiRunResult result = machine.run(tapes, heads, options);
+        out << tape << '\t' << outcome_name(result.outcome) << '\t' << result.steps;
+        if (!compare) {
+            for (long long head : result.heads) {
+                out << '\t' << head;
+            }
+            out << '\n';
+            continue;
+        }
+
+        // Same input as tuples of the k tracks, markers on the initial head cells
+        vector<Tape> initial;
+        machine.encode_tapes("<" + tape, head_pos, initial);
+        single_tape.reset(0);
+        long long leftmost = *min_element(heads.begin(), heads.end());
+        long long rightmost = max((long long)tape.size(), *max_element(heads.begin(), heads.end()));
+        for (long long pos = min(0LL, leftmost); pos <= rightmost; pos++) {
+            uint32_t tuple = 0;
+            for (int i = 0; i < k; i++) {
+                tuple += (initial[i].get(pos) * 2 + (heads[i] == pos)) * machine.tuple_weight(i);
+            }
+            single_tape.set(pos, uint8_t(tuple));
+        }
+        // A machine that halted halts in the simulation too, only later, so its step limit is lifted
+        single_options.max_steps = (result.outcome == OUT_TIMEOUT) ? options.max_steps : 0;
+        RunResult simulated = run_machine(single, single_tape, leftmost - 1, single_options);
+
+        // Compare every track with its tape, over the cells either side has written
+        bool agree = simulated.outcome == result.outcome;
+        int k_compared = (result.outcome == OUT_TIMEOUT) ? 0 : k;
+        pair<long long, long long> range = single_tape.nonblank_range();
+        for (int i = 0; i < k_compared && agree; i++) {
+            pair<long long, long long> written = tapes[i].nonblank_range();
+            long long from = min(range.first, written.first), to = max(range.second, written.second);
+            long long marker = LLONG_MIN;
+            for (long long pos = from; pos <= to && agree; pos++) {
+                uint32_t digit = single_tape.get(pos) / machine.tuple_weight(i) % (2 * n_symbols);
+                agree = (digit / 2 == tapes[i].get(pos));
+                if (digit % 2) {
+                    marker = pos;
+                }
+            }
+            agree = agree && marker == result.heads[i];
+        }
+        n_disagree += !agree;
+        out << '\t' << outcome_name(simulated.outcome) << '\t' << simulated.steps << '\t'
+            << double(simulated.steps) / max(1LL, result.steps) << '\t' << (agree ? "agree" : "DISAGREE") << '\n';
+    }
+    out.flush();
+    return n_disagree == 0;
+}
+
+/*****************************************************************/
+/************************** ENUMERATION **************************/
+/*****************************************************************/
+/* Enumerates every n-state, m-symbol machine in tree normal form and runs each on a blank tape.
+
+    The search starts from the machine with no transitions. Each candidate runs from
+    a blank tape until it reaches a missing transition, is proved not to halt, or
+    uses up max_steps. A missing transition is where the candidate halts: with a
+    halting transition there (writing 1 and moving right) it halts after one more
+    step, and is scored for steps and marks (non-blank cells). The candidate's
+    children then fill in the missing transition with every (write, move, next
+    state), unless that would leave no transition free to halt on.
+
+    Only one machine of each renaming is generated. States are numbered in order of
+    first use: a new transition may go to any used state or to the next unused one.
+    Symbols are numbered in order of first write in the same way, with 0 the blank.
+    The first transition moves right, since the mirrored machine behaves the same.
+    Transitions that a run never reaches are never filled in, so machines that only
+    differ there are never enumerated twice.
+
+    The candidates that never halt are pruned by the loop detector every
+    check_stride steps: a repeated configuration, or a state escaping over blank tape.
+
+    The tree is expanded level by level until there are enough subtrees for every
+    worker, and the subtrees are then searched depth first on the work-stealing pool.
+    Each worker owns one table, tape and loop detector and rewrites them in place for
+    every candidate, so the search allocates nothing per machine.
+*/
+struct EnumerateOptions {
+    uint32_t n_states = 2;
+    uint32_t n_symbols = 2;
+    long long max_steps = 10000;
+    long long check_stride = 64;
+    int n_threads = 1;
+};
+
+struct EnumerateChampion {
+    long long score = -1;       // steps or marks
+    string code;                // standard text format, e.g. 1RB1LB_1LA1RZ
+};
+
+struct EnumerateStats {
+    long long candidates = 0;
+    long long halting = 0;      // reached a missing transition, so halt with a halting transition there
+    long long looping = 0;      // proved never to halt
+    long long undecided = 0;    // still running after max_steps
+    EnumerateChampion most_steps;
+    EnumerateChampion most_marks;
+
+    // Keeps the higher score; ties go to the smaller code, so the result does not depend on the thread count
+    static void record(EnumerateChampion &champion, long long score, const function<string()> &code) {
+        if (score < champion.score) {
+            return;
+        }
+        string text = code();
+        if (score > champion.score || text < champion.code) {
+            champion.score = score;
+            champion.code = text;
+        }
+    }
+
+    void merge(const EnumerateStats &other) {
+        this->candidates += other.candidates;
+        this->halting += other.halting;
+        this->looping += other.looping;
+        this->undecided += other.undecided;
+        record(this->most_steps, other.most_steps.score, [&]() { return other.most_steps.code; });
+        record(this->most_marks, other.most_marks.score, [&]() { return other.most_marks.code; });
+    }
+};
+
+class Enumerator {
+
+    private:
+        // A subtree of the search: a partial table and what its transitions use so far
+        struct Node {
+            vector<uint32_t> table;
+            uint32_t defined;
+            uint32_t max_state;
+            uint8_t max_symbol;
+        };
+
+        struct Worker {
+            CompiledMachine cm;
+            uint32_t *table;
+            Tape tape;
+            unique_ptr<LoopDetector> detector;
+            EnumerateStats stats;
+        };
+
+        const EnumerateOptions options;
+        const uint32_t n_entries;
+        const uint32_t missing = pack_transition(0, 0, ACT_NONE);
+        vector<unique_ptr<Worker>> workers;
+
+        unique_ptr<Worker> make_worker() const {
+            unique_ptr<Worker> w(new Worker());
+            CompiledMachine &cm = w->cm;
+            cm.n_states = this->options.n_states;
+            cm.n_symbols = this->options.n_symbols;
+            cm.symbol_ids.fill(-1);
+            for (uint32_t s = 0; s < cm.n_states; s++) {
+                cm.state_names.push_back(string(1, char('A' + s)));
+            }
+            for (uint32_t y = 0; y < cm.n_symbols; y++) {
+                cm.symbols.push_back(char('0' + y));
+                cm.symbol_ids['0' + y] = int16_t(y);
+            }
+            cm.tape_alphabet.assign(cm.symbols.begin(), cm.symbols.end());
+            w->table = cm.allocate_table(this->missing);
+            w->detector.reset(new LoopDetector(cm));
+            return w;
+        }
+
+        // Standard text format: per state, per symbol, write-move-next; 1RZ halts, --- is never reached
+        string machine_code(const Worker &w, uint32_t halt_slot) const {
+            string code;
+            for (uint32_t slot = 0; slot < this->n_entries; slot++) {
+                if (slot > 0 && slot % this->options.n_symbols == 0) {
+                    code += '_';
+                }
+                uint32_t entry = w.table[slot];
+                if (slot == halt_slot) {
+                    code += "1RZ";
+                } else if (transition_action(entry) == ACT_NONE) {
+                    code += "---";
+                } else {
+                    code += char('0' + transition_write_symbol(entry));
+                    code += (transition_action(entry) == ACT_L) ? 'L' : 'R';
+                    code += char('A' + transition_next_state(entry));
+                }
+            }
+            return code;
+        }
+
+        // This function runs the candidate in the worker's table and scores it. Returns the missing slot it reached, or -1.
+        long long evaluate(Worker &w) const {
+            w.stats.candidates++;
+            w.tape.reset(0);
+            w.detector->reset();
+            RunResult run = w.cm.start(0);
+            while (run.outcome == OUT_RUNNING && run.steps < this->options.max_steps) {
+                w.cm.advance(w.tape, run, min(this->options.max_steps, run.steps + this->options.check_stride));
+                if (run.outcome == OUT_RUNNING && w.detector->proves_loop(w.tape, run)) {
+                    run.outcome = OUT_LOOP;
+                }
+            }
+            if (run.outcome == OUT_LOOP) {
+                w.stats.looping++;
+                return -1;
+            }
+            if (run.outcome != OUT_NO_TRANSITION) {
+                w.stats.undecided++;
+                return -1;
+            }
+
+            w.stats.halting++;
+            uint8_t symbol = w.tape.get(run.head_pos);
+            uint32_t slot = run.state * this->options.n_symbols + symbol;
+            long long marks = (symbol == 0);
+            for (const TapeSegment &segment : w.tape.segments()) {
+                for (size_t i = 0; i < segment.size; i++) {
+                    marks += (segment.cells[i] != 0);
+                }
+            }
+            auto code = [&]() { return machine_code(w, slot); };
+            EnumerateStats::record(w.stats.most_steps, run.steps + 1, code);
+            EnumerateStats::record(w.stats.most_marks, marks, code);
+            return slot;
+        }
+
+        // Calls visit(next_state, write, action) for every canonical transition filling a slot of a node
+        template <class Visit>
+        void for_each_child(uint32_t defined, uint32_t max_state, uint8_t max_symbol, Visit visit) const {
+            uint32_t last_state = min(this->options.n_states - 1, max_state + 1);
+            uint32_t last_symbol = min(this->options.n_symbols - 1, uint32_t(max_symbol) + 1);
+            for (uint32_t next = 0; next <= last_state; next++) {
+                for (uint32_t write = 0; write <= last_symbol; write++) {
+                    for (uint8_t action : {ACT_L, ACT_R}) {
+                        if (defined > 0 || action == ACT_R) {
+                            visit(next, uint8_t(write), action);
+                        }
+                    }
+                }
+            }
+        }
+
+        // This function searches the subtree of the candidate in the worker's table depth first
+        void explore(Worker &w, uint32_t defined, uint32_t max_state, uint8_t max_symbol) const {
+            long long slot = evaluate(w);
+            if (slot < 0 || defined + 1 >= this->n_entries) {
+                return;
+            }
+            for_each_child(defined, max_state, max_symbol, [&](uint32_t next, uint8_t write, uint8_t action) {
+                w.table[slot] = pack_transition(next, write, action);
+                explore(w, defined + 1, max(max_state, next), max(max_symbol, write));
+            });
+            w.table[slot] = this->missing;
+        }
+
+    public:
+        explicit Enumerator(const EnumerateOptions &options)
+            : options(options), n_entries(options.n_states * options.n_symbols) {}
+
+        EnumerateStats run() {
+            this->workers.clear();
+            for (int i = 0; i < this->options.n_threads; i++) {
+                this->workers.push_back(make_worker());
+            }
+
+            // Expand the top of the tree on one worker until every worker can have several subtrees
+            Worker &first = *this->workers[0];
+            vector<Node> frontier = {{vector<uint32_t>(this->n_entries, this->missing), 0, 0, 0}};
+            const size_t wanted = size_t(this->options.n_threads) * 64;
+            while (this->options.n_threads > 1 && !frontier.empty() && frontier.size() < wanted) {
+                vector<Node> next_level;
+                for (const Node &node : frontier) {
+                    copy(node.table.begin(), node.table.end(), first.table);
+                    long long slot = evaluate(first);
+                    if (slot < 0 || node.defined + 1 >= this->n_entries) {
+                        continue;
+                    }
+                    for_each_child(node.defined, node.max_state, node.max_symbol, [&](uint32_t next, uint8_t write, uint8_t action) {
+                        Node child = {node.table, node.defined + 1, max(node.max_state, next), max(node.max_symbol, write)};
+                        child.table[slot] = pack_transition(next, write, action);
+                        next_level.push_back(move(child));
+                    });
+                }
+                frontier = move(next_level);
+            }
+
+            parallel_for(frontier.size(), this->options.n_threads, [&](int worker, size_t i) {
+                Worker &w = *this->workers[worker];
+                const Node &node = frontier[i];
+                copy(node.table.begin(), node.table.end(), w.table);
+                explore(w, node.defined, node.max_state, node.max_symbol);
+            });
+
+            EnumerateStats total;
+            for (const auto &w : this->workers) {
+                total.merge(w->stats);
+            }
+            return total;
+        }
+};
+
+// This function enumerates the n-state, m-symbol machines and prints the counts, the champions and the candidates/second
+void run_enumeration(const EnumerateOptions &options, ostream &out) {
+    auto start = chrono::steady_clock::now();
+    EnumerateStats stats = Enumerator(options).run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    out << bold(underline(to_string(options.n_states) + "-state, " + to_string(options.n_symbols) + "-symbol machines:"))
+        << " step limit " << options.max_steps << endl;
+    out << stats.candidates << " candidates: " << stats.halting << " halting, " << stats.looping << " looping, "
+        << stats.undecided << " undecided" << endl;
+    out << bold("Most steps: ") << stats.most_steps.score << "  " << stats.most_steps.code << endl;
+    out << bold("Most marks: ") << stats.most_marks.score << "  " << stats.most_marks.code << endl;
+    out << seconds << " s, " << (long long)(stats.candidates / seconds) << " candidates/s, "
+        << options.n_threads << " threads" << endl;
+}
+
+/*****************************************************************/
+/************************ LANGUAGE TESTS *************************/
+/*****************************************************************/
+/* Runs a machine on every string over its input alphabet up to a length and compares acceptance with a reference.
+
+    Strings are visited depth first in the trie of their prefixes, so runs share the
+    work done on a common prefix. The machine runs with one extra symbol, END, which
+    has no transitions, written just past the prefix. A run on "<p" then stops in one
+    of two ways. It may halt without reading END: the cells past p are never read, so
+    every string starting with p gives the same result. Otherwise it stops reading END,
+    in the configuration that every string longer than p passes through. The run of p
+    itself continues from there with a blank in place of END, and the run of each
+    child p·a continues from there with a in place of END and END after it. A snapshot
+    keeps the cells from the lowest page written up to the end of the prefix, so for a
+    machine that stays on its input it is as short as the string.
+
+    The reference is a regular expression (ECMAScript, matching the whole string) or a
+    shell command. The command reads strings on stdin, one per line, and prints one
+    line per string: accept, 1, true or yes for a member, anything else otherwise. It
+    is started once per batch of LANGUAGE_BATCH strings.
+
+    The prefixes of a fixed length split the trie into subtrees for the work-stealing
+    pool. A worker checks its results against the reference every LANGUAGE_BATCH
+    strings and keeps only the shortest counterexamples, so memory does not grow with
+    the number of strings. A run that exceeds the step limit is counted as undecided
+    and not compared.
+*/
+const size_t LANGUAGE_BATCH = 1 << 16;
+const size_t LANGUAGE_MAX_COUNTEREXAMPLES = 20;
+const long long LANGUAGE_DEFAULT_MAX_STEPS = 1000000;
+
+struct LanguageOptions {
+    int max_length = 0;
+    string regex_text;          // used when not empty
+    string command;             // used otherwise
+    long long max_steps = LANGUAGE_DEFAULT_MAX_STEPS;
+    int n_threads = 1;
+};
+
+struct Counterexample {
+    string input;
+    bool machine_accepts;
+};
+
+class LanguageHarness {
+
+    private:
+        // The configuration when a run first reads the cell past its prefix, or the final result if it never does
+        struct Snapshot {
+            RunResult run;
+            bool settled;
+            long long from;             // position of cells[0]; the cells run up to the end of the prefix
+            vector<uint8_t> cells;
+        };
+
+        struct Worker {
+            Tape tape;
+            vector<Snapshot> stack;     // [depth] for the prefix being explored
+            string prefix;
+            vector<string> batch;
+            vector<char> batch_accepts;
+            size_t batch_size = 0;
+            long long tested = 0;
+            long long undecided = 0;
+            long long disagreements = 0;
+            vector<Counterexample> counterexamples;
+            string error;
+        };
+
+        const CompiledMachine &cm;
+        CompiledMachine with_end;
+        uint8_t end_symbol;
+        string alphabet;
+        array<int, 256> rank;           // character -> position in the alphabet, for shortlex order
+        LanguageOptions options;
+        regex pattern;
+        vector<unique_ptr<Worker>> workers;
+
+        bool shortlex_less(const string &a, const string &b) const {
+            if (a.size() != b.size()) {
+                return a.size() < b.size();
+            }
+            for (size_t i = 0; i < a.size(); i++) {
+                if (a[i] != b[i]) {
+                    return this->rank[(unsigned char)a[i]] < this->rank[(unsigned char)b[i]];
+                }
+            }
+            return false;
+        }
+
+        void restore(Worker &w, const Snapshot &snapshot) const {
+            w.tape.reset(this->cm.blank);
+            for (size_t i = 0; i < snapshot.cells.size(); i++) {
+                w.tape.set(snapshot.from + i, snapshot.cells[i]);
+            }
+        }
+
+        // This function continues a restored run until it halts, reads END or reaches the step limit
+        RunResult advance(Worker &w, RunResult run) const {
+            this->with_end.advance(w.tape, run, this->options.max_steps);
+            if (run.outcome == OUT_RUNNING) {
+                run.outcome = OUT_TIMEOUT;
+            }
+            return run;
+        }
+
+        // This function fills stack[depth + 1] for the prefix extended by symbol, from stack[depth]
+        void extend(Worker &w, int depth, uint8_t symbol) const {
+            const Snapshot &parent = w.stack[depth];
+            Snapshot &child = w.stack[depth + 1];
+            if (parent.settled) {
+                child.run = parent.run;
+                child.settled = true;
+                return;
+            }
+            long long end_pos = parent.from + parent.cells.size();
+            restore(w, parent);
+            w.tape.set(end_pos, symbol);
+            w.tape.set(end_pos + 1, this->end_symbol);
+            child.run = advance(w, parent.run);
+            child.settled = !(child.run.outcome == OUT_NO_TRANSITION && w.tape.get(child.run.head_pos) == this->end_symbol);
+            if (!child.settled) {
+                child.run.outcome = OUT_RUNNING;
+                child.from = min(parent.from, w.tape.lowest_page_start());
+                child.cells.resize(end_pos + 1 - child.from);
+                for (long long pos = child.from; pos <= end_pos; pos++) {
+                    child.cells[pos - child.from] = w.tape.get(pos);
+                }
+            }
+        }
+
+        // This function runs the prefix at stack[depth] itself and records the result
+        void test_prefix(Worker &w, int depth) {
+            const Snapshot &snapshot = w.stack[depth];
+            RunResult run = snapshot.run;
+            if (!snapshot.settled) {
+                restore(w, snapshot);
+                run = advance(w, run);
+            }
+            if (run.outcome == OUT_TIMEOUT) {
+                w.undecided++;
+                return;
+            }
+            if (w.batch_size == w.batch.size()) {
+                w.batch.emplace_back();
+                w.batch_accepts.emplace_back();
+            }
+            w.batch[w.batch_size] = w.prefix;
+            w.batch_accepts[w.batch_size] = (run.outcome == OUT_ACCEPT);
+            if (++w.batch_size == LANGUAGE_BATCH) {
+                check_batch(w);
+            }
+        }
+
+        /* Asks the command about the batch through a temporary file. Returns false if it could not answer.
+
+            The file is attached as the command's stdin rather than named in the shell
+            string, so TMPDIR can hold any characters.
+        */
+        bool run_command(Worker &w, vector<char> &members) const {
+            string path = (getenv("TMPDIR") ? string(getenv("TMPDIR")) : string("/tmp")) + "/turing-language-XXXXXX";
+            int fd = mkostemp(&path[0], O_CLOEXEC);
+            if (fd < 0) {
+                w.error = "Cannot create a temporary file for the reference command";
+                return false;
+            }
+            string input;
+            for (size_t i = 0; i < w.batch_size; i++) {
+                input += w.batch[i];
+                input += '\n';
+            }
+            int fds[2] = {-1, -1};
+            bool written = write(fd, input.data(), input.size()) == (ssize_t)input.size() && lseek(fd, 0, SEEK_SET) == 0 &&
+                           pipe2(fds, O_CLOEXEC) == 0;
+            pid_t pid = written ? fork() : -1;
+            if (pid == 0) {
+                dup2(fd, STDIN_FILENO);
+                dup2(fds[1], STDOUT_FILENO);
+                execl("/bin/sh", "sh", "-c", this->options.command.c_str(), (char *)nullptr);
+                _exit(127);
+            }
+            close(fd);
+            if (fds[1] >= 0) {
+                close(fds[1]);
+            }
+            FILE *pipe = (pid > 0) ? fdopen(fds[0], "r") : nullptr;
+            if (pipe == nullptr && fds[0] >= 0) {
+                close(fds[0]);
+            }
+            size_t n = 0;
+            if (pipe != nullptr) {
+                string answer;
+                int c;
+                while (n < w.batch_size && (c = fgetc(pipe)) != EOF) {
+                    if (c != '\n') {
+                        answer += char(c);
+                        continue;
+                    }
+                    trim(answer);
+                    members[n++] = (answer == "accept" || answer == "1" || answer == "true" || answer == "yes");
+                    answer.clear();
+                }
+                fclose(pipe);
+            }
+            if (pid > 0) {
+                waitpid(pid, nullptr, 0);
+            }
+            unlink(path.c_str());
+            if (n < w.batch_size) {
+                w.error = "The reference command answered " + to_string(n) + " of " + to_string(w.batch_size) + " strings";
+                return false;
+            }
+            return true;
+        }
+
+        // This function compares the buffered results with the reference and keeps the shortest counterexamples
+        void check_batch(Worker &w) {
+            vector<char> members(w.batch_size);
+            if (!this->options.regex_text.empty()) {
+                for (size_t i = 0; i < w.batch_size; i++) {
+                    members[i] = regex_match(w.batch[i], this->pattern);
+                }
+            } else if (!w.error.empty() || !run_command(w, members)) {
+                w.batch_size = 0;
+                return;
+            }
+            for (size_t i = 0; i < w.batch_size; i++) {
+                w.tested++;
+                if (bool(w.batch_accepts[i]) != bool(members[i])) {
+                    w.disagreements++;
+                    w.counterexamples.push_back({w.batch[i], bool(w.batch_accepts[i])});
+                }
+            }
+            w.batch_size = 0;
+            if (w.counterexamples.size() > 2 * LANGUAGE_MAX_COUNTEREXAMPLES) {
+                keep_shortest(w.counterexamples);
+            }
+        }
+
+        void keep_shortest(vector<Counterexample> &counterexamples) const {
+            sort(counterexamples.begin(), counterexamples.end(), [&](const Counterexample &a, const Counterexample &b) {
+                return shortlex_less(a.input, b.input);
+            });
+            if (counterexamples.size() > LANGUAGE_MAX_COUNTEREXAMPLES) {
+                counterexamples.resize(LANGUAGE_MAX_COUNTEREXAMPLES);
+            }
+        }
+
+        // This function tests the prefixes of lengths [emit_from, max_depth] in the subtree at stack[depth]
+        void explore(Worker &w, int depth, int emit_from, int max_depth) {
+            if (depth >= emit_from) {
+                test_prefix(w, depth);
+            }
+            if (depth == max_depth) {
+                return;
+            }
+            for (char c : this->alphabet) {
+                w.prefix.push_back(c);
+                extend(w, depth, uint8_t(this->cm.symbol_ids[(unsigned char)c]));
+                explore(w, depth + 1, emit_from, max_depth);
+                w.prefix.pop_back();
+            }
+        }
+
+    public:
+        LanguageHarness(const CompiledMachine &cm, const string &alphabet, const LanguageOptions &options)
+            : cm(cm), with_end(cm), end_symbol(uint8_t(cm.n_symbols)), alphabet(alphabet), options(options) {
+            this->rank.fill(0);
+            for (size_t i = 0; i < alphabet.size(); i++) {
+                this->rank[(unsigned char)alphabet[i]] = int(i);
+            }
+            // END is one more symbol whose column of the table is all missing transitions
+            this->with_end.n_symbols = cm.n_symbols + 1;
+            uint32_t *table = this->with_end.allocate_table(pack_transition(0, 0, ACT_NONE));
+            for (uint32_t state = 0; state < cm.n_states; state++) {
+                copy(cm.table + size_t(state) * cm.n_symbols, cm.table + size_t(state + 1) * cm.n_symbols,
+                     table + size_t(state) * this->with_end.n_symbols);
+            }
+        }
+
+        // Compiles the regular expression; returns an error message, or an empty string
+        string prepare() {
+            if (this->options.regex_text.empty()) {
+                return "";
+            }
+            try {
+                this->pattern = regex(this->options.regex_text, regex::ECMAScript | regex::optimize);
+            } catch (const regex_error &e) {
+                return string("Invalid regular expression: ") + e.what();
+            }
+            return "";
+        }
+
+        // This function tests every string and returns the totals with the shortest counterexamples in shortlex order
+        bool run(long long &tested, long long &undecided, long long &disagreements, vector<Counterexample> &counterexamples, string &error) {
+            const int k = this->alphabet.size();
+            const int n = this->options.max_length;
+            // Split at the shortest prefix length giving every worker several subtrees
+            int split = 0;
+            size_t n_subtrees = 1;
+            while (this->options.n_threads > 1 && k > 1 && split < n && n_subtrees < size_t(this->options.n_threads) * 16) {
+                split++;
+                n_subtrees *= k;
+            }
+            this->workers.clear();
+            for (int i = 0; i < this->options.n_threads; i++) {
+                unique_ptr<Worker> w(new Worker());
+                w->stack.resize(n + 1);
+                w->stack[0] = {this->cm.start(1), false, 0, vector<uint8_t>(1, this->cm.left_mark)};
+                this->workers.push_back(move(w));
+            }
+
+            // Task 0 tests the prefixes shorter than split, task 1 + i the subtree of the i-th prefix of length split
+            parallel_for(1 + n_subtrees, this->options.n_threads, [&](int worker, size_t task) {
+                Worker &w = *this->workers[worker];
+                w.prefix.clear();
+                if (task == 0) {
+                    if (split > 0) {
+                        explore(w, 0, 0, split - 1);
+                    }
+                    return;
+                }
+                size_t index = task - 1;
+                string digits(split, '\0');
+                for (int d = split - 1; d >= 0; d--) {
+                    digits[d] = this->alphabet[index % k];
+                    index /= k;
+                }
+                for (int d = 0; d < split; d++) {
+                    w.prefix.push_back(digits[d]);
+                    extend(w, d, uint8_t(this->cm.symbol_ids[(unsigned char)digits[d]]));
+                }
+                explore(w, split, split, n);
+            });
+
+            tested = undecided = disagreements = 0;
+            counterexamples.clear();
+            error.clear();
+            for (auto &w : this->workers) {
+                check_batch(*w);
+                tested += w->tested;
+                undecided += w->undecided;
+                disagreements += w->disagreements;
+                counterexamples.insert(counterexamples.end(), w->counterexamples.begin(), w->counterexamples.end());
+                if (error.empty()) {
+                    error = w->error;
+                }
+            }
+            keep_shortest(counterexamples);
+            return disagreements == 0 && error.empty();
+        }
+};
+
+// This function checks that the machine accepts exactly the reference language up to a length and prints the counterexamples
+bool run_language_test(const CompiledMachine &cm, const LanguageOptions &options, ostream &out) {
+    string alphabet = cm.input_alphabet.empty() ? cm.tape_alphabet : cm.input_alphabet;
+    if (cm.n_symbols >= 256) {
+        cerr << red("Error: Language tests need one spare tape symbol (at most 255 symbols)") << endl;
+        return false;
+    }
+    LanguageHarness harness(cm, alphabet, options);
+    string error = harness.prepare();
+    if (!error.empty()) {
+        cerr << red("Error: " + error) << endl;
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    long long tested, undecided, disagreements;
+    vector<Counterexample> counterexamples;
+    bool agree = harness.run(tested, undecided, disagreements, counterexamples, error);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!error.empty()) {
+        cerr << red("Error: " + error) << endl;
+    }
+    long long total = tested + undecided;
+    out << bold(underline("Strings up to length " + to_string(options.max_length) + " over {" + alphabet + "}:")) << ' '
+        << tested - disagreements << " agree, " << (disagreements ? red(to_string(disagreements) + " counterexamples") : string("0 counterexamples"))
+        << ", " << undecided << " undecided (step limit " << options.max_steps << ")" << endl;
+    out << total << " strings, " << seconds << " s, " << (long long)(total / seconds) << " strings/s, " << options.n_threads << " threads" << endl;
+    if (!counterexamples.empty()) {
+        out << bold("Shortest counterexamples:") << endl;
+        for (const Counterexample &c : counterexamples) {
+            out << "  \"" << c.input << "\"\tmachine " << (c.machine_accepts ? "accepts" : "rejects") << ", reference "
+                << (c.machine_accepts ? "rejects" : "accepts") << endl;
+        }
+    }
+    return agree;
+}
+
+/*****************************************************************/
+/*************************** DEBUGGER ****************************/
+/*****************************************************************/
+/* An interactive stepping debugger with breakpoints, watchpoints and reverse execution.
+
+    Every step forward appends an UndoEntry to a log: the state before the step, the
+    symbol it overwrote and the head's move. The cell written is the head position
+    before the step, so an entry alone restores the state, head and cell, and going
+    back N steps costs O(N). The log keeps the last DEBUG_UNDO_LIMIT steps. Every
+    snapshot_interval steps the whole configuration is also snapshotted. A step that
+    has fallen off the log is reached by restoring the last snapshot before it and
+    stepping forward from there, which rebuilds the log. Once there are more than
+    DEBUG_MAX_SNAPSHOTS snapshots, every other one is dropped and the interval
+    doubles, so memory stays bounded on long runs. The machine is deterministic, so
+    snapshots past the current step stay valid after going back.
+
+    Commands, one per line (an empty line repeats the last one):
+        s, step [N]             take N steps (default 1)
+        c, continue             run to a breakpoint, a watchpoint, a halt or max_steps
+        b, back [N]             go back N steps (default 1)
+        rc, rcontinue           go back to a breakpoint or watchpoint, or to the oldest logged step
+        goto N                  go to step N, forward or back
+        break STATE[,SYMBOL]    stop before a step in STATE (reading SYMBOL)
+        watch POS               stop when cell POS changes
+        delete                  remove every breakpoint and watchpoint
+        info                    list breakpoints, watchpoints and the steps that can be undone
+        p, print [FROM TO]      print the configuration, or the cells from FROM to TO
+        q, quit
+*/
+const size_t DEBUG_UNDO_LIMIT = 1 << 22;
+const size_t DEBUG_MAX_SNAPSHOTS = 64;
+const long long DEBUG_SNAPSHOT_INTERVAL = 1 << 16;
+
+struct UndoEntry {
+    uint32_t state;             // before the step
+    uint8_t symbol;             // overwritten at the head position before the step
+    int8_t move;                // head position after the step minus before
+};
+
+class Debugger {
+
+    private:
+        struct Snapshot {
+            RunResult run;
+            vector<pair<long long, vector<uint8_t>>> pages;     // non-blank pages
+        };
+
+        const CompiledMachine &cm;
+        long long max_steps;
+        Tape tape;
+        RunResult run;
+        deque<UndoEntry> undo_log;      // the last undo_log.size() steps before run.steps
+        vector<Snapshot> snapshots;     // in step order; the first is the initial configuration
+        long long snapshot_interval = DEBUG_SNAPSHOT_INTERVAL;
+        vector<bool> state_breaks;      // [state]
+        vector<bool> pair_breaks;       // [state * n_symbols + symbol]
+        set<long long> watches;
+        TraceWriter writer;
+
+        void take_snapshot() {
+            Snapshot snapshot = {this->run, {}};
+            for (const TapeSegment &segment : this->tape.segments()) {
+                snapshot.pages.emplace_back(segment.start, vector<uint8_t>(segment.cells, segment.cells + segment.size));
+            }
+            this->snapshots.push_back(move(snapshot));
+            if (this->snapshots.size() > DEBUG_MAX_SNAPSHOTS) {
+                size_t kept = 0;
+                for (size_t i = 0; i < this->snapshots.size(); i += 2) {
+                    this->snapshots[kept++] = move(this->snapshots[i]);
+                }
+                this->snapshots.resize(kept);
+                this->snapshot_interval *= 2;
+            }
+        }
+
+        void restore(const Snapshot &snapshot) {
+            this->tape.reset(this->cm.blank);
+            for (const auto &page : snapshot.pages) {
+                memcpy(this->tape.materialize(page.first), page.second.data(), page.second.size());
+            }
+            this->run = snapshot.run;
+            this->undo_log.clear();
+        }
+
+        bool at_breakpoint() const {
+            uint8_t symbol = this->tape.get(this->run.head_pos);
+            return this->state_breaks[this->run.state] || this->pair_breaks[this->run.state * this->cm.n_symbols + symbol];
+        }
+
+        // This function takes one step and logs it. Returns false when the machine cannot step.
+        bool step_forward() {
+            if (this->run.outcome != OUT_RUNNING || (this->max_steps > 0 && this->run.steps >= this->max_steps)) {
+                return false;
+            }
+            if (this->run.steps % this->snapshot_interval == 0 && this->snapshots.back().run.steps < this->run.steps) {
+                take_snapshot();
+            }
+            RunResult before = this->run;
+            uint8_t symbol = this->tape.get(before.head_pos);
+            this->cm.advance(this->tape, this->run, before.steps + 1);
+            if (this->run.steps == before.steps) {
+                return false;
+            }
+            this->undo_log.push_back({before.state, symbol, int8_t(this->run.head_pos - before.head_pos)});
+            if (this->undo_log.size() > DEBUG_UNDO_LIMIT) {
+                this->undo_log.pop_front();
+            }
+            return true;
+        }
+
+        // This function undoes the last logged step and returns the position it wrote, or LLONG_MIN if none is logged
+        long long step_back() {
+            if (this->undo_log.empty()) {
+                return LLONG_MIN;
+            }
+            UndoEntry entry = this->undo_log.back();
+            this->undo_log.pop_back();
+            long long pos = this->run.head_pos - entry.move;
+            this->tape.set(pos, entry.symbol);
+            this->run = {OUT_RUNNING, this->run.steps - 1, pos, entry.state};
+            return pos;
+        }
+
+        // True when the step just taken changed a watched cell; reports it
+        bool hit_watch(long long pos, uint8_t old_symbol) {
+            if (this->watches.count(pos) == 0 || this->tape.get(pos) == old_symbol) {
+                return false;
+            }
+            cout << cyan("Watchpoint: cell " + to_string(pos) + " " + this->cm.symbols[old_symbol] + " -> " +
+                         this->cm.symbols[this->tape.get(pos)]) << endl;
+            return true;
+        }
+
+        // This function runs forward until something stops it; breakpoints are checked after the first step
+        void resume() {
+            while (true) {
+                long long pos = this->run.head_pos;
+                uint8_t old_symbol = this->tape.get(pos);
+                if (!step_forward()) {
+                    return;
+                }
+                if (!this->watches.empty() && hit_watch(pos, old_symbol)) {
+                    return;
+                }
+                if (this->run.outcome == OUT_RUNNING && at_breakpoint()) {
+                    cout << cyan("Breakpoint") << endl;
+                    return;
+                }
+            }
+        }
+
+        void reverse_resume() {
+            while (true) {
+                uint8_t new_symbol = this->undo_log.empty() ? 0 : this->tape.get(this->run.head_pos - this->undo_log.back().move);
+                long long pos = step_back();
+                if (pos == LLONG_MIN) {
+                    cout << cyan("Reached the oldest step in the undo log") << endl;
+                    return;
+                }
+                if (this->watches.count(pos) && new_symbol != this->tape.get(pos)) {
+                    cout << cyan("Watchpoint: cell " + to_string(pos) + " " + this->cm.symbols[this->tape.get(pos)] + " -> " +
+                                 this->cm.symbols[new_symbol]) << endl;
+                    return;
+                }
+                if (at_breakpoint()) {
+                    cout << cyan("Breakpoint") << endl;
+                    return;
+                }
+            }
+        }
+
+        // This function moves to step target, undoing logged steps or restarting from the last snapshot before it
+        void go_to(long long target) {
+            target = max(0LL, target);
+            if (target < this->run.steps && this->run.steps - target > (long long)this->undo_log.size()) {
+                size_t i = this->snapshots.size();
+                while (this->snapshots[i - 1].run.steps > target) {
+                    i--;
+                }
+                restore(this->snapshots[i - 1]);
+            }
+            while (this->run.steps > target) {
+                step_back();
+            }
+            while (this->run.steps < target && step_forward()) {
+            }
+        }
+
+        void show() {
+            this->writer.emit(this->cm, this->tape, this->run);
+            this->writer.flush();
+            if (this->run.outcome == OUT_RUNNING && this->max_steps > 0 && this->run.steps >= this->max_steps) {
+                cout << cyan("Step limit reached") << endl;
+            } else if (this->run.outcome == OUT_ACCEPT) {
+                cout << green("Accepted.") << endl;
+            } else if (this->run.outcome == OUT_REJECT) {
+                cout << red("Rejected.") << endl;
+            } else if (this->run.outcome == OUT_NO_TRANSITION) {
+                cout << red("No transition for state " + this->cm.state_names[this->run.state] + " and symbol " +
+                            this->cm.symbols[this->tape.get(this->run.head_pos)]) << endl;
+            }
+        }
+
+        bool add_breakpoint(const string &spec) {
+            size_t comma = spec.find(',');
+            string name = spec.substr(0, comma);
+            auto state = find(this->cm.state_names.begin(), this->cm.state_names.end(), name);
+            if (state == this->cm.state_names.end()) {
+                cout << red("Error: Unknown state " + name) << endl;
+                return false;
+            }
+            uint32_t id = state - this->cm.state_names.begin();
+            if (comma == string::npos) {
+                this->state_breaks[id] = true;
+                return true;
+            }
+            string symbol = spec.substr(comma + 1);
+            if (symbol.size() != 1 || this->cm.symbol_ids[(unsigned char)symbol[0]] < 0) {
+                cout << red("Error: Unknown tape symbol " + symbol) << endl;
+                return false;
+            }
+            this->pair_breaks[id * this->cm.n_symbols + this->cm.symbol_ids[(unsigned char)symbol[0]]] = true;
+            return true;
+        }
+
+        void info() {
+            cout << bold("Breakpoints:");
+            for (uint32_t s = 0; s < this->cm.n_states; s++) {
+                if (this->state_breaks[s]) {
+                    cout << ' ' << this->cm.state_names[s];
+                }
+                for (uint32_t y = 0; y < this->cm.n_symbols; y++) {
+                    if (this->pair_breaks[s * this->cm.n_symbols + y]) {
+                        cout << ' ' << this->cm.state_names[s] << ',' << this->cm.symbols[y];
+                    }
+                }
+            }
+            cout << endl << bold("Watchpoints:");
+            for (long long pos : this->watches) {
+                cout << ' ' << pos;
+            }
+            cout << endl << bold("Undo log: ") << "steps " << this->run.steps - (long long)this->undo_log.size() << " to "
+                 << this->run.steps << ", " << this->snapshots.size() << " snapshots every " << this->snapshot_interval << " steps" << endl;
+        }
+
+    public:
+        Debugger(const CompiledMachine &cm, const string &tape, long long head_pos, long long max_steps)
+            : cm(cm), max_steps(max_steps), state_breaks(cm.n_states, false), pair_breaks(size_t(cm.n_states) * cm.n_symbols, false) {
+            cm.encode_tape(tape, this->tape);
+            this->run = cm.start(head_pos);
+            take_snapshot();
+        }
+
+        // This function reads commands until quit or the end of the input
+        void session(istream &in) {
+            bool prompt = isatty(STDIN_FILENO);
+            string line, last;
+            show();
+            while (true) {
+                if (prompt) {
+                    cout << bold("(tm) ") << flush;
+                }
+                if (!getline(in, line)) {
+                    break;
+                }
+                trim(line);
+                if (line.empty()) {
+                    line = last;
+                }
+                last = line;
+                istringstream words(line);
+                string command;
+                words >> command;
+                long long n = 1;
+                if (command == "s" || command == "step") {
+                    words >> n;
+                    for (long long i = 0; i < n && step_forward(); i++) {
+                    }
+                    show();
+                } else if (command == "c" || command == "continue") {
+                    resume();
+                    show();
+                } else if (command == "b" || command == "back") {
+                    words >> n;
+                    go_to(this->run.steps - n);
+                    show();
+                } else if (command == "rc" || command == "rcontinue") {
+                    reverse_resume();
+                    show();
+                } else if (command == "goto" && words >> n) {
+                    go_to(n);
+                    show();
+                } else if (command == "break") {
+                    string spec;
+                    words >> spec;
+                    add_breakpoint(spec);
+                } else if (command == "watch" && words >> n) {
+                    this->watches.insert(n);
+                } else if (command == "delete") {
+                    fill(this->state_breaks.begin(), this->state_breaks.end(), false);
+                    fill(this->pair_breaks.begin(), this->pair_breaks.end(), false);
+                    this->watches.clear();
+                } else if (command == "info") {
+                    info();
+                } else if (command == "p" || command == "print") {
+                    long long from, to;
+                    if (words >> from >> to) {
+                        cout << this->cm.decode_tape(this->tape, from, to + 1) << endl;
+                    } else {
+                        show();
+                    }
+                } else if (command == "q" || command == "quit") {
+                    break;
+                } else if (!command.empty()) {
+                    cout << red("Error: Unknown command " + command) << endl;
+                }
+            }
+        }
+};
+
+/*****************************************************************/
+/************************ BENCHMARK SUITE ************************/
+/*****************************************************************/
+/* Built-in reference machines, each run on a range of input sizes with every engine.
+
+    Busy beavers run on a blank tape of 0s; since the tape here starts with the left
+    mark and is otherwise blank, '#' and '<' are read as 0. Their step counts are
+    known, so the suite also checks them (an "expected" mismatch is a regression).
+    left-of-mark accepts by moving left of the mark and back onto it. Every case
+    also checks that no transition the optimizer reports as dead fires in the
+    first BENCH_ANALYSIS_STEPS steps of its first input.
+
+    Each case runs repeatedly for at least BENCH_MIN_SECONDS and reports steps/s and
+    ns/step over all repetitions, the tape cells allocated by one run (pages times
+    page size), and the peak RSS of the child process that ran only that case
+    with that engine. Output is a table, or CSV / JSON
+    rows with a suite version for comparing results between builds.
+*/
+const int BENCH_SUITE_VERSION = 3;
+const double BENCH_MIN_SECONDS = 0.2;
+const long long BENCH_ANALYSIS_STEPS = 1 << 20;
+
+struct BenchCase {
+    string name;
+    string definition;
+    vector<long long> sizes;
+    function<string(long long)> input;      // input tape (without the left mark) for a size
+    long long expected_steps;               // -1 if not known in advance
+};
+
+static string busy_beaver(const string &states, const vector<string> &rules) {
+    // rules: "A0 1RB" ...; H as the next state halts after writing
+    string text = "states: " + states + "\ninput: 0 1\ntape: 0 1 # <\ninitial: A\n";
+    for (const string &rule : rules) {
+        string state(1, rule[0]), write(1, rule[3]), move(1, rule[4]), next(1, rule[5]);
+        string action = (next == "H") ? "Y" : move;
+        if (next == "H") {
+            next = state;
+        }
+        vector<string> reads = (rule[1] == '0') ? vector<string>{"0", "#", "<"} : vector<string>{"1"};
+        for (const string &read : reads) {
+            text += "(" + state + "," + read + ") -> (" + next + "," + write + "," + action + ")\n";
+        }
+    }
+    return text;
+}
+
+vector<BenchCase> benchmark_cases() {
+    vector<BenchCase> cases;
+    cases.push_back({"bit-toggle",
+        "states: q0\ninput: 0 1\ntape: 0 1 #\ninitial: q0\n"
+        "(q0,0) -> (q0,1,R)\n(q0,1) -> (q0,0,R)\n(q0,#) -> (q0,#,Y)\n",
+        {10000, 1000000}, [](long long n) { return string(n, '1'); }, -1});
+    cases.push_back({"increment",
+        "states: q0 q1\ninput: 0 1\ntape: 0 1 #\ninitial: q0\n"
+        "(q0,0) -> (q0,0,R)\n(q0,1) -> (q0,1,R)\n(q0,#) -> (q1,#,L)\n"
+        "(q1,0) -> (q1,1,Y)\n(q1,1) -> (q1,0,L)\n(q1,#) -> (q1,1,Y)\n",
+        {10000, 1000000}, [](long long n) { return "0" + string(n - 1, '1'); }, -1});
+    cases.push_back({"unary-adder",
+        "states: a b c\ninput: 0 1\ntape: 0 1 #\ninitial: a\n"
+        "(a,1) -> (a,1,R)\n(a,0) -> (b,1,R)\n(b,1) -> (b,1,R)\n(b,#) -> (c,#,L)\n(c,1) -> (c,#,Y)\n",
+        {10000, 1000000}, [](long long n) { return string(n / 2, '1') + "0" + string(n / 2, '1'); }, -1});
+    cases.push_back({"palindrome",
+        "states: s r0 r1 c0 c1 back\ninput: 0 1\ntape: 0 1 #\ninitial: s\n"
+        "(s,0) -> (r0,#,R)\n(s,1) -> (r1,#,R)\n(s,#) -> (s,#,Y)\n"
+        "(r0,0) -> (r0,0,R)\n(r0,1) -> (r0,1,R)\n(r0,#) -> (c0,#,L)\n"
+        "(r1,0) -> (r1,0,R)\n(r1,1) -> (r1,1,R)\n(r1,#) -> (c1,#,L)\n"
+        "(c0,0) -> (back,#,L)\n(c0,1) -> (c0,1,N)\n(c0,#) -> (c0,#,Y)\n"
+        "(c1,1) -> (back,#,L)\n(c1,0) -> (c1,0,N)\n(c1,#) -> (c1,#,Y)\n"
+        "(back,0) -> (back,0,L)\n(back,1) -> (back,1,L)\n(back,#) -> (s,#,R)\n",
+        {100, 1000, 3000}, [](long long n) {
+            string half;
+            for (long long i = 0; i < n / 2; i++) {
+                half += (i * i % 7 < 3) ? '0' : '1';
+            }
+            return half + string(half.rbegin(), half.rend());
+        }, -1});
+    cases.push_back({"counter",
+        "states: inc back\ninput: 0 1\ntape: 0 1 # <\ninitial: inc\n"
+        "(inc,1) -> (inc,0,L)\n(inc,0) -> (back,1,R)\n(inc,<) -> (inc,<,Y)\n"
+        "(back,0) -> (back,0,R)\n(back,1) -> (back,1,R)\n(back,#) -> (inc,#,L)\n",
+        {16, 20}, [](long long n) { return string(n, '0'); }, -1});
+    cases.push_back({"left-of-mark",
+        "states: s a b c\ninput: 0\ntape: 0 # <\ninitial: s\n"
+        "(s,0) -> (a,0,L)\n(a,<) -> (b,<,L)\n(b,#) -> (c,#,R)\n(c,<) -> (c,<,Y)\n",
+        {1}, [](long long) { return string("0"); }, 4});
+    cases.push_back({"busy-beaver-2", busy_beaver("A B", {"A0 1RB", "A1 1LB", "B0 1LA", "B1 1RH"}),
+        {0}, [](long long) { return string(); }, 6});
+    cases.push_back({"busy-beaver-3", busy_beaver("A B C", {"A0 1RB", "A1 1RH", "B0 1LB", "B1 0RC", "C0 1LC", "C1 1LA"}),
+        {0}, [](long long) { return string(); }, 21});
+    cases.push_back({"busy-beaver-4", busy_beaver("A B C D", {"A0 1RB", "A1 1LB", "B0 1LA", "B1 0LC",
+                                                              "C0 1RH", "C1 1LD", "D0 1RD", "D1 0RA"}),
+        {0}, [](long long) { return string(); }, 107});
+    cases.push_back({"busy-beaver-5", busy_beaver("A B C D E", {"A0 1RB", "A1 1LC", "B0 1RC", "B1 1RB", "C0 1RD",
+                                                                "C1 0LE", "D0 1LA", "D1 1LD", "E0 1RH", "E1 0LA"}),
+        {0}, [](long long) { return string(); }, 47176870});
+    return cases;
+}
+
+struct BenchResult {
+    string machine;
+    long long size;
+    string engine;
+    Outcome outcome;
+    long long steps;            // of one run
+    long long runs;
+    double seconds;             // over all runs
+    size_t tape_cells;
+    long long peak_rss_kb;
+    bool expected;              // steps match the known count (true when none is known)
+};
+
+// What a benchmark child process sends back through its pipe
+struct BenchMeasurement {
+    Outcome outcome;
+    long long steps;
+    long long runs;
+    double seconds;
+    size_t tape_cells;
+};
+
+/* This function measures one case in a forked child, so peak_rss_kb is the child's own high-water mark.
+
+    The child starts with the parent's resident pages, so every case shares the same
+    floor, but nothing an earlier case allocated is counted. Returns false if the
+    child cannot be started or does not report back.
+*/
+static bool measure_in_child(const CompiledMachine &cm, const string &tape, const RunOptions &options, BenchResult &result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        RunTapes tapes;
+        BenchMeasurement m = {OUT_RUNNING, 0, 0, 0, 0};
+        do {
+            auto start = chrono::steady_clock::now();
+            RunResult run = run_on_tape(cm, tape, 1, tapes, options);
+            m.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            m.outcome = run.outcome;
+            m.steps = run.steps;
+            m.runs++;
+        } while (m.seconds < BENCH_MIN_SECONDS);
+        m.tape_cells = tapes.page_count() * Tape::PAGE_SIZE;
+        bool sent = write(fds[1], &m, sizeof(m)) == (ssize_t)sizeof(m);
+        _exit(sent ? 0 : 1);
+    }
+    close(fds[1]);
+    BenchMeasurement m;
+    bool received = read(fds[0], &m, sizeof(m)) == (ssize_t)sizeof(m);
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !received) {
+        return false;
+    }
+    result.outcome = m.outcome;
+    result.steps = m.steps;
+    result.runs = m.runs;
+    result.seconds = m.seconds;
+    result.tape_cells = m.tape_cells;
+    result.peak_rss_kb = usage.ru_maxrss;
+    return true;
+}
+
+// This function runs the suite (cases whose name contains filter) and writes the results in format: text, csv or json
+bool run_benchmarks(const string &filter, const string &format, ostream &out) {
+    struct BenchEngine {
+        string name;
+        Engine engine;
+        TapeMode tape_mode;
+    };
+    const BenchEngine engines[] = {{"naive", ENGINE_NAIVE, TAPE_AUTO}, {"packed", ENGINE_NAIVE, TAPE_PACKED},
+                                   {"accel", ENGINE_ACCELERATED, TAPE_AUTO}};
+    vector<BenchResult> results;
+    bool analysis_holds = true;
+    if (format == "text") {
+        out << bold(underline("Benchmark suite:")) << " version " << BENCH_SUITE_VERSION << endl;
+    }
+    for (const BenchCase &bench : benchmark_cases()) {
+        if (bench.name.find(filter) == string::npos) {
+            continue;
+        }
+        TuringMachine tm;
+        istringstream definition(bench.definition);
+        tm.load_TM_specs(definition, bench.name);
+        CompiledMachine cm;
+        tm.compile(cm);
+        OptimizeReport report;
+        CompiledMachine optimized = optimize_machine(cm, report);
+        if (!check_dead_pairs(optimized, report, "<" + bench.input(bench.sizes[0]), BENCH_ANALYSIS_STEPS)) {
+            cerr << red("Error: " + bench.name + ": the optimizer reports a transition as dead that fires") << endl;
+            analysis_holds = false;
+        }
+        for (long long size : bench.sizes) {
+            string tape = "<" + bench.input(size);
+            for (const BenchEngine &engine : engines) {
+                if (engine.tape_mode == TAPE_PACKED && cm.packed_bits() == 0) {
+                    continue;
+                }
+                RunOptions options;
+                options.engine = engine.engine;
+                options.tape_mode = engine.tape_mode;
+                BenchResult result = {bench.name, size, engine.name, OUT_RUNNING, 0, 0, 0, 0, 0, true};
+                out.flush();
+                if (!measure_in_child(cm, tape, options, result)) {
+                    cerr << red("Error: Cannot run benchmark " + bench.name + " [" + engine.name + "] in a child process") << endl;
+                    return false;
+                }
+                result.expected = bench.expected_steps < 0 || bench.expected_steps == result.steps;
+                results.push_back(result);
+
+                if (format == "text") {
+                    double rate = result.steps * result.runs / result.seconds;
+                    out << bold(result.machine + (bench.sizes.size() > 1 ? " n=" + to_string(size) : "") + " [" + result.engine + "]: ")
+                        << outcome_name(result.outcome) << ", " << result.steps << " steps, "
+                        << (long long)rate << " steps/s, " << 1e9 / rate << " ns/step, "
+                        << result.tape_cells << " cells, " << result.peak_rss_kb << " KB peak RSS"
+                        << (result.expected ? "" : red(" (expected " + to_string(bench.expected_steps) + " steps)")) << endl;
+                }
+            }
+        }
+    }
+
+    if (format == "csv") {
+        out << "suite_version,machine,size,engine,outcome,steps,runs,seconds,steps_per_second,ns_per_step,tape_cells,peak_rss_kb,expected\n";
+        for (const BenchResult &r : results) {
+            double rate = r.steps * r.runs / r.seconds;
+            out << BENCH_SUITE_VERSION << ',' << r.machine << ',' << r.size << ',' << r.engine << ',' << outcome_name(r.outcome) << ','
+                << r.steps << ',' << r.runs << ',' << r.seconds << ',' << (long long)rate << ',' << 1e9 / rate << ','
+                << r.tape_cells << ',' << r.peak_rss_kb << ',' << (r.expected ? "true" : "false") << '\n';
+        }
+    } else if (format == "json") {
+        out << "{\"suite_version\": " << BENCH_SUITE_VERSION << ", \"results\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            double rate = r.steps * r.runs / r.seconds;
+            out << (i ? ",\n  " : "\n  ") << "{\"machine\": \"" << r.machine << "\", \"size\": " << r.size
+                << ", \"engine\": \"" << r.engine << "\", \"outcome\": \"" << outcome_name(r.outcome) << "\", \"steps\": " << r.steps
+                << ", \"runs\": " << r.runs << ", \"seconds\": " << r.seconds << ", \"steps_per_second\": " << (long long)rate
+                << ", \"ns_per_step\": " << 1e9 / rate << ", \"tape_cells\": " << r.tape_cells
+                << ", \"peak_rss_kb\": " << r.peak_rss_kb << ", \"expected\": " << (r.expected ? "true" : "false") << "}";
+        }
+        out << "\n]}\n";
+    }
+    out.flush();
+
+    for (const BenchResult &r : results) {
+        if (!r.expected) {
+            return false;
+        }
+    }
+    return analysis_holds;
+}
+
+/* This function times loading a generated definition with n transitions, with the TuringMachine loader and the fast loader
+
+    The machine has n / 3 states (rounded up) over the tape symbols 0 1 #, with random transitions.
+    Each loader runs three times and the best time is reported; the two compiled
+    machines must be identical.
+*/
+bool benchmark_loading(long long n) {
+    long long n_states = (n + 2) / 3;
+    string path = (getenv("TMPDIR") ? string(getenv("TMPDIR")) : string("/tmp")) + "/turing-load-" + to_string(getpid()) + ".tm";
+    {
+        ofstream file(path);
+        if (!file) {
+            cerr << red("Error: Cannot write " + path) << endl;
+            return false;
+        }
+        file << "states:";
+        for (long long i = 0; i < n_states; i++) {
+            file << " s" << i;
+        }
+        file << "\ninput: 0 1\ntape: 0 1 #\ninitial: s0\n";
+        uint64_t random = 88172645463325252ULL;
+        const char symbols[] = "01#", actions[] = "LRLRLRYN";
+        for (long long i = 0; i < n; i++) {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            file << "(s" << i / 3 << "," << symbols[i % 3] << ") -> (s" << random % n_states << ","
+                 << symbols[(random >> 20) % 3] << "," << actions[(random >> 30) % 8] << ")\n";
+        }
+    }
+    struct stat info;
+    stat(path.c_str(), &info);
+
+    auto time_best = [](function<bool()> load) {
+        double best = 1e300;
+        for (int i = 0; i < 3; i++) {
+            auto start = chrono::steady_clock::now();
+            if (!load()) {
+                return -1.0;
+            }
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    };
+    CompiledMachine parsed, mapped;
+    double parse_seconds = time_best([&]() {
+        TuringMachine tm;
+        if (!tm.load_TM_specs_from_file(path)) {
+            return false;
+        }
+        return tm.compile(parsed);
+    });
+    double map_seconds = time_best([&]() {
+        DefinitionLoader loader;
+        return loader.load(path, mapped);
+    });
+    unlink(path.c_str());
+    if (parse_seconds < 0 || map_seconds < 0) {
+        return false;
+    }
+    bool same = parsed.state_names == mapped.state_names && parsed.symbols == mapped.symbols &&
+                parsed.initial_state == mapped.initial_state &&
+                memcmp(parsed.table, mapped.table, size_t(parsed.n_states) * parsed.n_symbols * sizeof(uint32_t)) == 0;
+
+    cout << bold(underline("Load benchmark:")) << " " << n << " transitions, " << n_states << " states, "
+         << info.st_size << " bytes" << endl;
+    cout << bold("TuringMachine loader: ") << parse_seconds * 1e3 << " ms, " << (long long)(n / parse_seconds) << " transitions/s" << endl;
+    cout << bold("Fast loader: ") << map_seconds * 1e3 << " ms, " << (long long)(n / map_seconds) << " transitions/s, "
+         << info.st_size / map_seconds / 1e6 << " MB/s" << endl;
+    cout << bold("Speedup: ") << parse_seconds / map_seconds << "x, "
+         << (same ? green("identical machines") : red("the machines differ")) << endl;
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    bool compare = false;
+    RunOptions options;
+    bool trace_given = false;
+    bool bench_scaling = false;
+    bool stats = false;
+    bool decode_unary = false, encode_unary = false;
+    bool universal = false, bench_universal = false, engine_given = false;
+    bool nondeterministic = false;
+    bool multitape = false, compare_single = false;
+    bool bench = false;
+    bool profile = false;
+    long long profile_sample = 64;
+    string profile_path;
+    string checkpoint_path;
+    double checkpoint_every = 30;
+    bool resume = false;
+    long long bench_load = 0;
+    bool optimize = false, bench_optimize = false;
+    string bench_filter, bench_format = "text";
+    size_t max_configs = 1 << 22;
+    string emit_path, binary_path;
+    bool enumerating = false;
+    EnumerateOptions enumerate;
+    bool language_test = false;
+    bool debug = false;
+    LanguageOptions language;
+    int n_threads = default_thread_count();
+    string machine_path, tapes_path = "-";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--compare") {
+            compare = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            if (!parse_trace_option(argv[++i], options)) {
+                cout << red("Error: Invalid trace level " + string(argv[i]) + " (expected none, sampled:N or full)") << endl;
+                return 1;
+            }
+            trace_given = true;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            if (!parse_engine_option(argv[++i], options)) {
+                cout << red("Error: Invalid engine " + string(argv[i]) + " (expected naive or accel)") << endl;
+                return 1;
+            }
+            engine_given = true;
+        } else if (arg == "--max-steps" && i + 1 < argc) {
+            options.max_steps = atoll(argv[++i]);
+        } else if (arg == "--time-limit" && i + 1 < argc) {
+            options.time_limit = atof(argv[++i]);
+        } else if (arg == "--detect-loops") {
+            options.detect_loops = true;
+        } else if (arg == "--byte-tape") {
+            options.tape_mode = TAPE_BYTES;
+        } else if (arg == "--packed-tape") {
+            options.tape_mode = TAPE_PACKED;
+        } else if (arg == "--machine" && i + 1 < argc) {
+            machine_path = argv[++i];
+        } else if (arg == "--tapes" && i + 1 < argc) {
+            tapes_path = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            n_threads = atoi(argv[++i]);
+            if (n_threads < 1) {
+                cout << red("Error: --threads expects a positive number") << endl;
+                return 1;
+            }
+        } else if (arg == "--bench-scaling") {
+            bench_scaling = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--emit-cpp" && i + 1 < argc) {
+            emit_path = argv[++i];
+        } else if (arg == "--save-binary" && i + 1 < argc) {
+            binary_path = argv[++i];
+        } else if (arg == "--encode-unary") {
+            encode_unary = true;
+        } else if (arg == "--decode-unary") {
+            decode_unary = true;
+        } else if (arg == "--nondeterministic") {
+            nondeterministic = true;
+        } else if (arg == "--max-configs" && i + 1 < argc) {
+            max_configs = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--multitape") {
+            multitape = true;
+        } else if (arg == "--compare-single") {
+            compare_single = true;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--bench-filter" && i + 1 < argc) {
+            bench_filter = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            bench_format = argv[++i];
+            if (bench_format != "text" && bench_format != "csv" && bench_format != "json") {
+                cout << red("Error: Invalid format " + bench_format + " (expected text, csv or json)") << endl;
+                return 1;
+            }
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--profile-out" && i + 1 < argc) {
+            profile = true;
+            profile_path = argv[++i];
+        } else if (arg == "--profile-sample" && i + 1 < argc) {
+            profile_sample = atoll(argv[++i]);
+            if (profile_sample < 1) {
+                cout << red("Error: --profile-sample expects a positive number") << endl;
+                return 1;
+            }
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpoint_every = atof(argv[++i]);
+        } else if (arg == "--resume" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+            resume = true;
+        } else if (arg == "--bench-load" && i + 1 < argc) {
+            bench_load = atoll(argv[++i]);
+            if (bench_load < 1) {
+                cout << red("Error: --bench-load expects a positive number of transitions") << endl;
+                return 1;
+            }
+        } else if (arg == "--optimize") {
+            optimize = true;
+        } else if (arg == "--bench-optimize") {
+            bench_optimize = true;
+        } else if (arg == "--enumerate" && i + 1 < argc) {
+            enumerate.n_states = atoi(argv[++i]);
+            if (enumerate.n_states < 1 || enumerate.n_states > 26) {
+                cout << red("Error: --enumerate expects a number of states from 1 to 26") << endl;
+                return 1;
+            }
+            enumerating = true;
+        } else if (arg == "--symbols" && i + 1 < argc) {
+            enumerate.n_symbols = atoi(argv[++i]);
+            if (enumerate.n_symbols < 2 || enumerate.n_symbols > 10) {
+                cout << red("Error: --symbols expects a number of symbols from 2 to 10") << endl;
+                return 1;
+            }
+        } else if (arg == "--language" && i + 1 < argc) {
+            language.max_length = atoi(argv[++i]);
+            if (language.max_length < 0) {
+                cout << red("Error: --language expects a maximum string length") << endl;
+                return 1;
+            }
+            language_test = true;
+        } else if (arg == "--regex" && i + 1 < argc) {
+            language.regex_text = argv[++i];
+        } else if (arg == "--reference" && i + 1 < argc) {
+            language.command = argv[++i];
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "--utm") {
+            universal = true;
+        } else if (arg == "--bench-utm") {
+            bench_universal = true;
+        } else {
+            cout << red("Error: Unknown option " + arg) << endl;
+            return 1;
+        }
+    }
+
+    // Writes the generated program for the loaded machine
+    auto emit = [&](const CompiledMachine &cm) {
+        ofstream file(emit_path);
+        if (!file) {
+            cerr << red("Error: Cannot write " + emit_path) << endl;
+            return false;
+        }
+        emit_cpp(cm, file);
+        return true;
+    };
+
+    // The UTM spends most of its steps sweeping the same cells, which the accelerated engine skips through
+    if ((universal || bench_universal) && !engine_given) {
+        options.engine = ENGINE_ACCELERATED;
+    }
+    if (bench) {
+        return run_benchmarks(bench_filter, bench_format, cout) ? 0 : 1;
+    }
+    if (enumerating) {
+        enumerate.n_threads = n_threads;
+        if (options.max_steps > 0) {
+            enumerate.max_steps = options.max_steps;
+        }
+        run_enumeration(enumerate, cout);
+        return 0;
+    }
+    if (bench_load > 0) {
+        return benchmark_loading(bench_load) ? 0 : 1;
+    }
+    if (bench_universal) {
+        benchmark_universal(options);
+        return 0;
+    }
+
+    if (decode_unary) {
+        UnaryDecoder decoder(cin);
+        UnaryTransition t;
+        const char actions[] = {'L', 'R', 'Y', 'N'};
+        while (decoder.next(t)) {
+            cout << "(q" << t.state - 1 << "," << t.tape_symbol - 1 << ") -> (q" << t.next_state - 1 << ","
+                 << t.write_symbol - 1 << "," << actions[t.action - 1] << ")" << '\n';
+        }
+        if (!decoder.get_error().empty()) {
+            cerr << red("Error: " + decoder.get_error()) << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    TuringMachine TM = TuringMachine();
+    if (!machine_path.empty()) {
+        CompiledMachine cm;
+        MultiTapeMachine multi;
+        if (multitape) {
+            ifstream file(machine_path);
+            if (!file) {
+                cerr << red("Error: Cannot open machine definition " + machine_path) << endl;
+                return 1;
+            }
+            if (!multi.load_specs(file, machine_path)) {
+                return 1;
+            }
+            if (encode_unary || universal || nondeterministic || !binary_path.empty() || !emit_path.empty()) {
+                cerr << red("Error: A multi-tape machine can only be run in batch mode or with --compare-single") << endl;
+                return 1;
+            }
+        } else if (is_binary_machine(machine_path)) {
+            if (!load_binary(machine_path, cm)) {
+                return 1;
+            }
+            if (encode_unary || universal || nondeterministic) {
+                cerr << red("Error: --encode-unary, --utm and --nondeterministic need a machine definition file") << endl;
+                return 1;
+            }
+        } else if (!nondeterministic && !encode_unary && !universal) {
+            DefinitionLoader loader;
+            if (!loader.load(machine_path, cm)) {
+                return 1;
+            }
+        } else {
+            if (nondeterministic) {
+                TM.allow_nondeterminism();
+            }
+            if (!TM.load_TM_specs_from_file(machine_path)) {
+                return 1;
+            }
+            if (TM.has_alternatives() && (encode_unary || universal || !binary_path.empty() || !emit_path.empty())) {
+                cerr << red("Error: The machine is nondeterministic; it can only be run with --nondeterministic") << endl;
+                return 1;
+            }
+            if (encode_unary) {
+                cout << TM.get_machine_code() << endl;
+                return 0;
+            }
+            if (!TM.compile(cm)) {
+                return 1;
+            }
+        }
+        CompiledMachine original = cm;
+        if ((optimize || bench_optimize) && !multitape && !nondeterministic && !universal) {
+            OptimizeReport report;
+            cm = optimize_machine(original, report);
+            print_optimize_report(cm, report, bench_optimize ? cout : cerr);
+        }
+        if (!binary_path.empty()) {
+            return save_binary(cm, binary_path) ? 0 : 1;
+        }
+        if (!emit_path.empty()) {
+            return emit(cm) ? 0 : 1;
+        }
+        if (language_test) {
+            if (multitape || nondeterministic || universal) {
+                cerr << red("Error: --language tests a single-tape deterministic machine") << endl;
+                return 1;
+            }
+            if (language.regex_text.empty() == language.command.empty()) {
+                cerr << red("Error: --language needs one reference: --regex PATTERN or --reference COMMAND") << endl;
+                return 1;
+            }
+            language.n_threads = n_threads;
+            if (options.max_steps > 0) {
+                language.max_steps = options.max_steps;
+            }
+            return run_language_test(cm, language, cout) ? 0 : 1;
+        }
+        ifstream tapes_file;
+        if (tapes_path != "-") {
+            tapes_file.open(tapes_path);
+            if (!tapes_file) {
+                cerr << red("Error: Cannot open tapes file " + tapes_path) << endl;
+                return 1;
+            }
+        }
+        istream &tapes = (tapes_path == "-") ? cin : tapes_file;
+        if (debug) {
+            // The first line of the tapes holds the tape to debug; commands follow on stdin
+            string line, tape;
+            TapeJob job;
+            if (multitape || nondeterministic || universal) {
+                cerr << red("Error: --debug steps a single-tape deterministic machine") << endl;
+                return 1;
+            }
+            if (!getline(tapes, line) || !read_tape_job(cm, line, tape, job)) {
+                cerr << red("Error: --debug expects a valid tape on the first line of the tapes") << endl;
+                return 1;
+            }
+            Debugger(cm, job.tape, job.head_pos, options.max_steps).session(cin);
+            return 0;
+        }
+        if (multitape) {
+            return run_multitape(multi, tapes, cout, options, compare_single) ? 0 : 1;
+        } else if (nondeterministic) {
+            ChoiceMachine machine;
+            if (!TM.compile_choices(machine)) {
+                return 1;
+            }
+            run_nondeterministic(machine, tapes, cout, options, n_threads, max_configs, stats);
+        } else if (universal) {
+            return run_universal(TM, tapes, cout, options) ? 0 : 1;
+        } else if (bench_optimize) {
+            return benchmark_optimizer(original, cm, tapes, options) ? 0 : 1;
+        } else if (!checkpoint_path.empty()) {
+            return run_with_checkpoints(cm, tapes, cout, options, checkpoint_path, checkpoint_every, resume) ? 0 : 1;
+        } else if (profile) {
+            return run_profile(cm, tapes, cout, options, profile_sample, profile_path) ? 0 : 1;
+        } else if (bench_scaling) {
+            benchmark_scaling(cm, tapes);
+        } else {
+            run_batch(cm, tapes, cout, options, n_threads, stats);
+        }
+        return 0;
+    }
+
+    TM.get_TM_specs_from_user();
+    TM.print_TM_specs();
+    CompiledMachine compiled;
+    if (!TM.compile(compiled)) {
+        return 1;
+    }
+    if (!emit_path.empty() && emit(compiled)) {
+        cout << bold("Generated program written to ") << emit_path << endl;
+    }
+
+    TM.translate_TM_to_machine_code();
+
+    pair<string, int> tape = TM.get_input_tape();
+    if (debug) {
+        Debugger(compiled, tape.first, tape.second, options.max_steps).session(cin);
+        return 0;
+    }
+    if (!trace_given) {
+        options.trace = TRACE_FULL;
+    }
+    TM.run_TM(tape.first, tape.second, options);
+    if (compare) {
+        TM.compare_engines(tape.first, tape.second);
+    }
+
+
+    return 0;
+}